@@ -0,0 +1,160 @@
+#include "buffer_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "sharedmem.h"
+
+// The compositor is done reading the buffer, it can be drawn into again
+static void pool_buffer_release(void* data, struct wl_buffer* buffer) {
+    struct pool_buffer* released = (struct pool_buffer*) data;
+    if (released->pinned) {
+        released->release_held = 1;
+        return;
+    }
+    buffer_pool_release(released);
+}
+
+static const struct wl_buffer_listener pool_buffer_listener = {
+.release = pool_buffer_release
+};
+
+struct buffer_pool* buffer_pool_create(struct wl_shm* shm, int width, int height, int count) {
+    if (count < 1) {
+        count = 1;
+    }
+    if (count > BUFFER_POOL_MAX) {
+        count = BUFFER_POOL_MAX;
+    }
+
+    struct buffer_pool* pool = (struct buffer_pool*) calloc(1, sizeof(struct buffer_pool));
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->width = width;
+    pool->height = height;
+    pool->stride = width * 4; // XRGB8888
+    pool->count = count;
+
+    size_t buffer_size = (size_t) pool->stride * height;
+    pool->size = buffer_size * count;
+
+    pool->release_fd = eventfd(0, EFD_CLOEXEC);
+    if (pool->release_fd < 0) {
+        perror("Could not create release eventfd");
+        free(pool);
+        return NULL;
+    }
+
+    pool->fd = allocate_shm_file(pool->size);
+    if (pool->fd < 0) {
+        fprintf(stderr, "Could not allocate shared memory for %d buffers\n", count);
+        close(pool->release_fd);
+        free(pool);
+        return NULL;
+    }
+
+    // Populating the mapping now keeps page faults out of the frame loop
+    pool->data = mmap(NULL, pool->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pool->fd, 0);
+    if (pool->data == MAP_FAILED) {
+        perror("Could not map shared memory");
+        close(pool->fd);
+        close(pool->release_fd);
+        free(pool);
+        return NULL;
+    }
+
+    struct wl_shm_pool* shm_pool = wl_shm_create_pool(shm, pool->fd, (int32_t) pool->size);
+    for (int i = 0; i < count; i++) {
+        struct pool_buffer* buffer = &pool->buffers[i];
+        size_t offset = buffer_size * i;
+
+        buffer->index = i;
+        buffer->content_width = width;
+        buffer->content_height = height;
+        buffer->pool = pool;
+        buffer->pixels = (uint32_t*) (pool->data + offset);
+        buffer->buffer = wl_shm_pool_create_buffer(shm_pool, (int32_t) offset, width, height,
+                                                   pool->stride, WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(buffer->buffer, &pool_buffer_listener, buffer);
+    }
+    atomic_init(&pool->free, (1u << count) - 1);
+
+    // Buffers keep the memory alive on the compositor side, the pool object
+    // itself is no longer needed
+    wl_shm_pool_destroy(shm_pool);
+
+    return pool;
+}
+
+void buffer_pool_destroy(struct buffer_pool* pool) {
+    if (!pool) {
+        return;
+    }
+
+    for (int i = 0; i < pool->count; i++) {
+        wl_buffer_destroy(pool->buffers[i].buffer);
+    }
+    munmap(pool->data, pool->size);
+    close(pool->fd);
+    close(pool->release_fd);
+    free(pool);
+}
+
+struct pool_buffer* buffer_pool_acquire(struct buffer_pool* pool) {
+    unsigned int free = atomic_load(&pool->free);
+    while (free != 0) {
+        // Lowest free buffer, the mask is retried if another thread raced us
+        int index = __builtin_ctz(free);
+        if (atomic_compare_exchange_weak(&pool->free, &free, free & ~(1u << index))) {
+            return &pool->buffers[index];
+        }
+    }
+    return NULL;
+}
+
+struct pool_buffer* buffer_pool_acquire_wait(struct buffer_pool* pool) {
+    struct pool_buffer* buffer = buffer_pool_acquire(pool);
+    if (!buffer) {
+        // A release between the acquire and the read leaves the counter set
+        uint64_t count;
+        if (read(pool->release_fd, &count, sizeof(count)) != sizeof(count)) {
+            return NULL;
+        }
+        buffer = buffer_pool_acquire(pool);
+    }
+    return buffer;
+}
+
+void buffer_pool_release(struct pool_buffer* buffer) {
+    struct buffer_pool* pool = buffer->pool;
+    unsigned int bit = 1u << buffer->index;
+    if (atomic_fetch_or(&pool->free, bit) & bit) {
+        return; // Already free
+    }
+    buffer_pool_wake(pool);
+}
+
+void buffer_pool_pin(struct pool_buffer* buffer) {
+    buffer->pinned = 1;
+}
+
+void buffer_pool_unpin(struct pool_buffer* buffer) {
+    buffer->pinned = 0;
+    if (buffer->release_held) {
+        buffer->release_held = 0;
+        buffer_pool_release(buffer);
+    }
+}
+
+void buffer_pool_wake(struct buffer_pool* pool) {
+    uint64_t one = 1;
+    if (write(pool->release_fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("Could not signal buffer release");
+    }
+}
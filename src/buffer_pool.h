@@ -0,0 +1,79 @@
+#ifndef BUFFER_POOL_H_
+#define BUFFER_POOL_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+/*
+** Persistent set of wl_buffers for one surface size
+**
+** All buffers are carved out of a single shared memory file that is mapped
+** once and touched up front, so handing out a buffer costs no syscalls and
+** no page faults. A buffer is taken from acquire until it is released,
+** either by the compositor or by its owner. The free set is an atomic bit
+** mask, so a render thread can acquire while the Wayland thread releases.
+*/
+
+#define BUFFER_POOL_MAX 3
+
+struct buffer_pool;
+
+struct pool_buffer {
+    struct wl_buffer* buffer;
+    // XRGB8888 pixels, stride bytes per row
+    uint32_t* pixels;
+
+    // Size of the image in the top left corner, up to the pool size
+    int content_width;
+    int content_height;
+
+    int index;
+    struct buffer_pool* pool;
+
+    // Kept out of the free set while pinned, a compositor release is held
+    // back until the buffer is unpinned. Only touched on the Wayland thread.
+    int pinned;
+    int release_held;
+};
+
+struct buffer_pool {
+    int fd;
+    uint8_t* data;
+    size_t size;
+
+    int width;
+    int height;
+    int stride;
+
+    int count;
+    struct pool_buffer buffers[BUFFER_POOL_MAX];
+    // Bit i set while buffers[i] is free
+    atomic_uint free;
+    // eventfd signalled on every release
+    int release_fd;
+
+    // Retired pools waiting for destruction, see renderer.h
+    struct buffer_pool* next_retired;
+};
+
+// count is clamped to 1..BUFFER_POOL_MAX. Returns NULL on failure.
+struct buffer_pool* buffer_pool_create(struct wl_shm* shm, int width, int height, int count);
+void buffer_pool_destroy(struct buffer_pool* pool);
+
+// A buffer nobody is using, NULL while every one is taken
+struct pool_buffer* buffer_pool_acquire(struct buffer_pool* pool);
+// Blocks on release_fd until a buffer is free or the pool is woken
+struct pool_buffer* buffer_pool_acquire_wait(struct buffer_pool* pool);
+// Returns an acquired buffer, safe from any thread
+void buffer_pool_release(struct pool_buffer* buffer);
+// Keeps a buffer the compositor releases from being acquired again until
+// it is unpinned, so its pixels can still be read. Wayland thread only.
+void buffer_pool_pin(struct pool_buffer* buffer);
+void buffer_pool_unpin(struct pool_buffer* buffer);
+// Interrupts a buffer_pool_acquire_wait, which then returns NULL
+void buffer_pool_wake(struct buffer_pool* pool);
+
+#endif // BUFFER_POOL_H_
@@ -0,0 +1,205 @@
+#include "compress.h"
+
+#include <string.h>
+#include <zlib.h>
+
+size_t packbits_bound(size_t size, size_t row_size) {
+    size_t rows = row_size > 0 ? (size + row_size - 1) / row_size : 1;
+    // A literal run of 128 bytes costs one header byte
+    return size + rows * ((row_size + 127) / 128) + rows;
+}
+
+static size_t packbits_encode_row(const uint8_t* row, size_t n, uint8_t* out) {
+    size_t o = 0;
+    size_t i = 0;
+
+    while (i < n) {
+        // Length of the run of equal bytes starting at i
+        size_t run = 1;
+        while (i + run < n && run < 128 && row[i + run] == row[i]) {
+            run++;
+        }
+
+        if (run >= 2) {
+            out[o++] = (uint8_t) (257 - run); // -(run - 1) as a signed byte
+            out[o++] = row[i];
+            i += run;
+            continue;
+        }
+
+        // Literal bytes up to the next run of three or more
+        size_t start = i;
+        size_t literal = 0;
+        while (i < n && literal < 128) {
+            if (i + 2 < n && row[i] == row[i + 1] && row[i] == row[i + 2]) {
+                break;
+            }
+            i++;
+            literal++;
+        }
+
+        out[o++] = (uint8_t) (literal - 1);
+        memcpy(out + o, row + start, literal);
+        o += literal;
+    }
+
+    return o;
+}
+
+size_t packbits_encode(const uint8_t* data, size_t size, size_t row_size, uint8_t* out) {
+    size_t o = 0;
+    for (size_t start = 0; start < size; start += row_size) {
+        size_t n = size - start < row_size ? size - start : row_size;
+        o += packbits_encode_row(data + start, n, out + o);
+    }
+    return o;
+}
+
+#define LZW_CLEAR 256
+#define LZW_EOI 257
+#define LZW_FIRST 258
+#define LZW_BITS_MIN 9
+#define LZW_BITS_MAX 12
+#define LZW_CODE_MAX ((1 << LZW_BITS_MAX) - 1)
+
+// Open addressing table from (prefix code, next byte) to code
+#define LZW_HASH_SIZE 9001
+
+struct lzw_state {
+    int32_t keys[LZW_HASH_SIZE];
+    uint16_t codes[LZW_HASH_SIZE];
+
+    uint8_t* out;
+    size_t pos;
+    uint32_t bits;
+    int bit_count;
+    int nbits;
+    int next_code;
+};
+
+static void lzw_put(struct lzw_state* lzw, int code) {
+    lzw->bits = (lzw->bits << lzw->nbits) | (uint32_t) code;
+    lzw->bit_count += lzw->nbits;
+    while (lzw->bit_count >= 8) {
+        lzw->bit_count -= 8;
+        lzw->out[lzw->pos++] = (uint8_t) (lzw->bits >> lzw->bit_count);
+    }
+}
+
+static void lzw_reset(struct lzw_state* lzw) {
+    for (int i = 0; i < LZW_HASH_SIZE; i++) {
+        lzw->keys[i] = -1;
+    }
+    lzw->nbits = LZW_BITS_MIN;
+    lzw->next_code = LZW_FIRST;
+}
+
+// A new table entry was made, the decoder widens codes one entry early
+static void lzw_grow(struct lzw_state* lzw) {
+    lzw->next_code++;
+    if (lzw->next_code == LZW_CODE_MAX - 1) {
+        lzw_put(lzw, LZW_CLEAR);
+        lzw_reset(lzw);
+    } else if (lzw->next_code > (1 << lzw->nbits) - 1) {
+        lzw->nbits++;
+    }
+}
+
+size_t lzw_bound(size_t size) {
+    // At worst every byte is its own 12 bit code, plus clear codes and EOI
+    return size + size / 2 + size / 1024 + 16;
+}
+
+size_t lzw_encode(const uint8_t* data, size_t size, uint8_t* out) {
+    static _Thread_local struct lzw_state lzw;
+
+    lzw.out = out;
+    lzw.pos = 0;
+    lzw.bits = 0;
+    lzw.bit_count = 0;
+    lzw_reset(&lzw);
+    lzw_put(&lzw, LZW_CLEAR);
+
+    if (size > 0) {
+        int prefix = data[0];
+
+        for (size_t i = 1; i < size; i++) {
+            int32_t key = (prefix << 8) | data[i];
+            size_t slot = (size_t) key % LZW_HASH_SIZE;
+            while (lzw.keys[slot] != -1 && lzw.keys[slot] != key) {
+                slot = slot + 1 == LZW_HASH_SIZE ? 0 : slot + 1;
+            }
+
+            if (lzw.keys[slot] == key) {
+                prefix = lzw.codes[slot];
+                continue;
+            }
+
+            lzw_put(&lzw, prefix);
+            lzw.keys[slot] = key;
+            lzw.codes[slot] = (uint16_t) lzw.next_code;
+            lzw_grow(&lzw);
+            prefix = data[i];
+        }
+
+        lzw_put(&lzw, prefix);
+        lzw_grow(&lzw);
+    }
+
+    lzw_put(&lzw, LZW_EOI);
+    if (lzw.bit_count > 0) {
+        out[lzw.pos++] = (uint8_t) (lzw.bits << (8 - lzw.bit_count));
+    }
+
+    return lzw.pos;
+}
+
+size_t deflate_bound(size_t size) {
+    return (size_t) compressBound((uLong) size);
+}
+
+size_t deflate_encode(const uint8_t* data, size_t size, uint8_t* out, size_t out_size, int level) {
+    uLongf written = (uLongf) out_size;
+    if (compress2(out, &written, data, (uLong) size, level) != Z_OK) {
+        return 0;
+    }
+    return (size_t) written;
+}
+
+void predictor_encode(uint8_t* data, size_t size, size_t row_size, size_t sample_size) {
+    for (size_t start = 0; start < size; start += row_size) {
+        size_t n = (size - start < row_size ? size - start : row_size) / sample_size;
+
+        if (sample_size == 2) {
+            uint16_t* row = (uint16_t*) (data + start);
+            for (size_t i = n - 1; i > 0; i--) {
+                row[i] = (uint16_t) (row[i] - row[i - 1]);
+            }
+        } else {
+            uint8_t* row = data + start;
+            for (size_t i = n - 1; i > 0; i--) {
+                row[i] = (uint8_t) (row[i] - row[i - 1]);
+            }
+        }
+    }
+}
+
+void float_predictor_encode(uint8_t* data, size_t size, size_t row_size, uint8_t* row_buffer) {
+    for (size_t start = 0; start < size; start += row_size) {
+        size_t bytes = size - start < row_size ? size - start : row_size;
+        size_t n = bytes / 4;
+        uint8_t* row = data + start;
+
+        // Most significant bytes of every sample first, then the next ones
+        memcpy(row_buffer, row, bytes);
+        for (size_t i = 0; i < n; i++) {
+            for (size_t b = 0; b < 4; b++) {
+                row[(3 - b) * n + i] = row_buffer[i * 4 + b];
+            }
+        }
+
+        for (size_t i = bytes - 1; i > 0; i--) {
+            row[i] = (uint8_t) (row[i] - row[i - 1]);
+        }
+    }
+}
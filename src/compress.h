@@ -0,0 +1,36 @@
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** Encoders for the TIFF compression schemes
+**
+** Every encoder writes into a caller provided buffer of at least the matching
+** *_bound bytes and returns the encoded size, 0 on failure. They keep no
+** state between calls and can run on any number of threads at once.
+*/
+
+// PackBits, every row is packed on its own as TIFF requires
+size_t packbits_bound(size_t size, size_t row_size);
+size_t packbits_encode(const uint8_t* data, size_t size, size_t row_size, uint8_t* out);
+
+// TIFF flavour of LZW, MSB first codes of 9 to 12 bits with early change
+size_t lzw_bound(size_t size);
+size_t lzw_encode(const uint8_t* data, size_t size, uint8_t* out);
+
+// zlib wrapped Deflate
+size_t deflate_bound(size_t size);
+size_t deflate_encode(const uint8_t* data, size_t size, uint8_t* out, size_t out_size, int level);
+
+// Horizontal differencing predictor, in place. Rows are row_size bytes of
+// 1 or 2 byte little endian samples.
+void predictor_encode(uint8_t* data, size_t size, size_t row_size, size_t sample_size);
+
+// Floating point predictor for 32 bit floats, each row is split into byte
+// planes, most significant first, which are then differenced bytewise.
+// row_buffer holds at least row_size bytes.
+void float_predictor_encode(uint8_t* data, size_t size, size_t row_size, uint8_t* row_buffer);
+
+#endif // COMPRESS_H_
@@ -0,0 +1,65 @@
+#ifndef CONTEXT_H_
+#define CONTEXT_H_
+
+#include <stdint.h>
+
+/*
+** Noise context
+**
+** Everything a noise field depends on besides its coordinates: the seed of
+** the hashed lattice and the permutation tables of the table based
+** engines. Noise functions only read their context, so any number of
+** fields can be generated on any number of threads at once.
+**
+** Tables hold bytes, 256 entries repeated once so lattice lookups need no
+** wrap, and a few bytes of padding for the 4 byte gathers of the SIMD
+** kernels. With decorrelated octaves the octaves cycle through
+** NOYC_OCTAVE_TABLES tables, octaves 4 apart share one, and every octave
+** hashes with a seed of its own, so features of neighbouring octaves do
+** not line up. Four tables take about
+** 2 KiB, as much as the single int table they replace, and stay in L1.
+*/
+
+// Bytes of one permutation table
+#define NOYC_PERM_SIZE 516
+// Tables of a context with decorrelated octaves
+#define NOYC_OCTAVE_TABLES 4
+
+struct noyc_context {
+    uint32_t seed;
+    // Tables in use, 1 or NOYC_OCTAVE_TABLES
+    int tables;
+    uint8_t perm[NOYC_OCTAVE_TABLES][NOYC_PERM_SIZE];
+};
+
+// Ken Perlin's permutation table and hash seed 0, what every function
+// without a context samples
+extern const struct noyc_context noyc_default_context;
+
+// Shuffles the tables from seed. With decorrelate the octaves cycle through
+// NOYC_OCTAVE_TABLES tables and get a hash seed each.
+void noyc_context_init(struct noyc_context* context, uint32_t seed, int decorrelate);
+
+// Entry i of a table. Reads the 4 bytes from i on and keeps the first, so
+// loops over many samples vectorize into 32 bit gathers, which plain byte
+// loads do not.
+typedef uint32_t noyc_perm_word __attribute__((may_alias, aligned(1)));
+
+static inline int noyc_perm(const uint8_t* perm, int i) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return (int) (*(const noyc_perm_word*) (perm + i) & 255);
+#else
+    return perm[i];
+#endif
+}
+
+// Table and hash seed of an octave
+static inline const uint8_t* noyc_context_perm(const struct noyc_context* context, int octave) {
+    return context->perm[octave % context->tables];
+}
+
+static inline uint32_t noyc_context_seed(const struct noyc_context* context, int octave) {
+    return context->tables > 1 ? context->seed + (uint32_t) octave * 0x9e3779b9u : context->seed;
+}
+
+#endif // CONTEXT_H_
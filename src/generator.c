@@ -0,0 +1,144 @@
+#include "generator.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "pool.h"
+
+// Rows every band generates
+#define GENERATOR_BAND_ROWS 32
+// Bands per worker and batch
+#define GENERATOR_BATCH_BANDS 4
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Every worker band holds width samples per row
+static int reserve_band_rows(struct generator* generator, int width) {
+    if (width <= generator->band_width) {
+        return 0;
+    }
+
+    for (int i = 0; i < generator->band_count; i++) {
+        double* band = (double*) realloc(generator->band_rows[i], sizeof(double) * width * GENERATOR_BAND_ROWS);
+        if (!band) {
+            return -1;
+        }
+        generator->band_rows[i] = band;
+    }
+    generator->band_width = width;
+    return 0;
+}
+
+static void generate_band(void* arg, int task, int worker) {
+    struct generator* generator = (struct generator*) arg;
+    const struct generator_grid* grid = &generator->grid;
+    double* band = generator->band_rows[worker];
+
+    if (atomic_load(&generator->cancelled)) {
+        return;
+    }
+
+    int y = (generator->next_band + task) * GENERATOR_BAND_ROWS;
+    int rows = grid->height - y < GENERATOR_BAND_ROWS ? grid->height - y : GENERATOR_BAND_ROWS;
+
+    if (grid->dimensions == 4) {
+        noise4_fill_grid(grid->engine, grid->context, grid->ox, grid->oy + y * grid->dy, grid->oz, grid->ow,
+            grid->dx, grid->dy, grid->width, rows,
+            grid->octaves,
+            grid->persistence,
+            grid->bfreq,
+            grid->bamp,
+            band);
+    } else {
+        noise_fill_grid(grid->engine, grid->context, grid->ox, grid->oy + y * grid->dy, grid->oz, grid->dx, grid->dy,
+            grid->width, rows,
+            grid->octaves,
+            grid->persistence,
+            grid->bfreq,
+            grid->bamp,
+            band);
+    }
+    generator->emit(generator->arg, y, rows, band, worker);
+}
+
+int generator_init(struct generator* generator, struct pool* workers) {
+    generator->workers = workers;
+    generator->next_band = 0;
+    generator->bands = 0;
+    generator->band_width = 0;
+    atomic_init(&generator->cancelled, 0);
+
+    generator->band_count = workers ? pool_threads(workers) : 1;
+    generator->band_rows = (double**) calloc(generator->band_count, sizeof(double*));
+    if (!generator->band_rows) {
+        return -1;
+    }
+    return 0;
+}
+
+void generator_destroy(struct generator* generator) {
+    if (generator->band_rows) {
+        for (int i = 0; i < generator->band_count; i++) {
+            free(generator->band_rows[i]);
+        }
+        free(generator->band_rows);
+        generator->band_rows = NULL;
+    }
+    generator->band_width = 0;
+}
+
+int generator_begin(struct generator* generator, const struct generator_grid* grid, generator_emit_fn emit, void* arg) {
+    if (reserve_band_rows(generator, grid->width) != 0) {
+        return -1;
+    }
+
+    generator->grid = *grid;
+    generator->emit = emit;
+    generator->arg = arg;
+    generator->next_band = 0;
+    generator->bands = (grid->height + GENERATOR_BAND_ROWS - 1) / GENERATOR_BAND_ROWS;
+    atomic_store(&generator->cancelled, 0);
+    return 0;
+}
+
+int generator_step(struct generator* generator, int64_t budget_ns) {
+    int64_t deadline = now_ns() + budget_ns;
+
+    // The budget is checked between batches, which give every worker a few
+    // bands to balance out
+    int batch = generator->band_count * GENERATOR_BATCH_BANDS;
+
+    while (generator->next_band < generator->bands) {
+        if (atomic_load(&generator->cancelled)) {
+            return -1;
+        }
+
+        int count = generator->bands - generator->next_band;
+        if (count > batch) {
+            count = batch;
+        }
+        if (generator->workers) {
+            pool_run(generator->workers, count, generate_band, generator);
+        } else {
+            generate_band(generator, 0, 0);
+        }
+        generator->next_band += count;
+
+        if (budget_ns > 0 && now_ns() >= deadline) {
+            break;
+        }
+    }
+
+    if (atomic_load(&generator->cancelled)) {
+        return -1;
+    }
+    return generator->next_band == generator->bands;
+}
+
+void generator_cancel(struct generator* generator) {
+    atomic_store(&generator->cancelled, 1);
+}
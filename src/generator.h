@@ -0,0 +1,82 @@
+#ifndef GENERATOR_H_
+#define GENERATOR_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "noise.h"
+
+/*
+** Resumable octave noise generator
+**
+** A generator walks a grid of samples in bands of rows. Every step
+** generates bands until its time budget is used up and remembers the next
+** one, so a host can spread a grid over as many steps as it likes, check
+** for work of its own in between and drop the grid at any point. Finished
+** bands go to the emit callback, which gets rows in order only without a
+** worker pool.
+**
+** With a pool every batch of bands is spread over its workers. Cancelling
+** is safe from any thread, bands not started yet are then skipped.
+*/
+
+struct pool;
+
+// Takes rows x width samples of the grid from row y on
+typedef void (*generator_emit_fn)(void* arg, int y, int rows, const double* values, int worker);
+
+// What a generator samples, the same grid noise_fill_grid takes, or with
+// dimensions 4 the one noise4_fill_grid takes
+struct generator_grid {
+    enum noise_engine engine;
+    const struct noyc_context* context;
+    int dimensions;
+    double ox;
+    double oy;
+    double oz;
+    double ow;
+    double dx;
+    double dy;
+    int width;
+    int height;
+
+    int octaves;
+    double persistence;
+    double bfreq;
+    double bamp;
+};
+
+struct generator {
+    struct generator_grid grid;
+    generator_emit_fn emit;
+    void* arg;
+
+    // Next band to generate, and how many there are
+    int next_band;
+    int bands;
+    atomic_int cancelled;
+
+    // Optional, NULL generates on the calling thread
+    struct pool* workers;
+    // Band of rows per worker, band_width samples wide
+    double** band_rows;
+    int band_count;
+    int band_width;
+};
+
+// Returns -1 on failure
+int generator_init(struct generator* generator, struct pool* workers);
+void generator_destroy(struct generator* generator);
+
+// Starts over on a new grid, returns -1 when scratch memory runs out
+int generator_begin(struct generator* generator, const struct generator_grid* grid, generator_emit_fn emit, void* arg);
+
+// Generates bands for about budget_ns, at least one batch, <= 0 runs to the
+// end. Returns 1 once the grid is complete, 0 while bands remain and -1
+// when it was cancelled.
+int generator_step(struct generator* generator, int64_t budget_ns);
+
+// Stops the grid in progress, safe from any thread
+void generator_cancel(struct generator* generator);
+
+#endif // GENERATOR_H_
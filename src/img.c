@@ -1,32 +1,60 @@
 #include "img.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
-
-#define TIFF_BYTE_ORDER_LL 0x4949;
-#define TIFF_VERSION 42;
-
-#define TIFF_TAG_IMAGE_WIDTH 256;
-#define TIFF_TAG_IMAGE_LENGTH 257;
-#define TIFF_TAG_BITS_PER_SAMPLE 258;
-#define TIFF_TAG_COMPRESSION 259;
-#define TIFF_TAG_PHOTOMERIC_INTERPRETATION 262;
-#define TIFF_TAG_STRIP_OFFSETS 273;
-#define TIFF_TAG_SAMPLES_PER_PIXEL 277;
-#define TIFF_TAG_ROWS_PER_STRIP 278;
-#define TIFF_TAG_STRIP_BYTE_COUNTS 279;
-#define TIFF_TAG_X_RESOLUTION 282;
-#define TIFF_TAG_Y_RESOLUTION 283;
-#define TIFF_TAG_RESOLUTION_UNIT 296;
-#define TIFF_TAG_SAMPLE_FORMAT 339;
-
-
-#define TIFF_TYPE_BYTE 1;
-#define TIFF_TYPE_ASCII 2;
-#define TIFF_TYPE_SHORT 3;
-#define TIFF_TYPE_LONG 4;
-#define TIFF_TYPE_RATIONAL 5;
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "compress.h"
+
+#define TIFF_BYTE_ORDER_LL 0x4949
+#define TIFF_VERSION 42
+#define TIFF_VERSION_BIG 43
+
+#define TIFF_TAG_IMAGE_WIDTH 256
+#define TIFF_TAG_IMAGE_LENGTH 257
+#define TIFF_TAG_BITS_PER_SAMPLE 258
+#define TIFF_TAG_COMPRESSION 259
+#define TIFF_TAG_PHOTOMERIC_INTERPRETATION 262
+#define TIFF_TAG_STRIP_OFFSETS 273
+#define TIFF_TAG_SAMPLES_PER_PIXEL 277
+#define TIFF_TAG_ROWS_PER_STRIP 278
+#define TIFF_TAG_STRIP_BYTE_COUNTS 279
+#define TIFF_TAG_X_RESOLUTION 282
+#define TIFF_TAG_Y_RESOLUTION 283
+#define TIFF_TAG_RESOLUTION_UNIT 296
+#define TIFF_TAG_PREDICTOR 317
+#define TIFF_TAG_TILE_WIDTH 322
+#define TIFF_TAG_TILE_LENGTH 323
+#define TIFF_TAG_TILE_OFFSETS 324
+#define TIFF_TAG_TILE_BYTE_COUNTS 325
+#define TIFF_TAG_SAMPLE_FORMAT 339
+
+
+#define TIFF_TYPE_BYTE 1
+#define TIFF_TYPE_ASCII 2
+#define TIFF_TYPE_SHORT 3
+#define TIFF_TYPE_LONG 4
+#define TIFF_TYPE_RATIONAL 5
+#define TIFF_TYPE_LONG8 16
+
+#define TIFF_PREDICTOR_NONE 1
+#define TIFF_PREDICTOR_HORIZONTAL 2
+#define TIFF_PREDICTOR_FLOAT 3
+
+#define TIFF_SAMPLE_FORMAT_UINT 1
+#define TIFF_SAMPLE_FORMAT_IEEEFP 3
+
+// Fastest zlib level, higher ones cost more time than generating the noise
+// for little gain, the predictor shrinks files more cheaply
+#define TIFF_DEFLATE_LEVEL 1
 
 typedef struct {
     uint16_t tag;
@@ -35,133 +63,732 @@ typedef struct {
     uint32_t value_offset;
 } TiffIFDEntry;
 
-int write_image_to_ttf(const uint8_t* data, int width, int height, float dpi, const char* filename) {
-    FILE* fhandle = fopen(filename, "wb");
-    if (!fhandle) {
-        perror("Could not open file for writing");
-        return -1;
+// BigTIFF entry, 64 bit count and value / offset
+typedef struct __attribute__((packed)) {
+    uint16_t tag;
+    uint16_t type;
+    uint64_t count;
+    uint64_t value_offset;
+} TiffIFD8Entry;
+
+// An IFD entry before it is serialised as classic or BigTIFF
+struct tiff_field {
+    uint16_t tag;
+    uint16_t type;
+    uint64_t count;
+    uint64_t value_offset;
+};
+
+#define TIFF_MAX_FIELDS 16
+
+// Where everything goes in the file, offsets are from the start of the file.
+// The header and every page's IFD, rationals and offset arrays form one
+// block in front of the data. Offsets are those of the first page, the
+// blocks of later pages follow it every page_size bytes.
+struct tiff_layout {
+    int bigtiff;
+    size_t offset_size;   // Size of an offset or inline value
+    size_t header_size;
+    size_t page_size;
+    size_t ifd_size;
+    size_t x_res_offset;
+    size_t y_res_offset;
+    size_t chunk_offsets_offset;
+    size_t chunk_counts_offset;
+    size_t image_data_offset;
+    size_t image_data_size;
+};
+
+struct tiff_writer {
+    int fd;
+    int width;
+    int height;
+    float dpi;
+
+    // Chunks are either strips or tiles, numbered across all pages
+    int tiled;
+    int rows_per_strip;
+    int tile_width;
+    int tile_length;
+    int pages;
+    size_t page_chunks;
+    size_t chunks;
+    size_t chunk_size;
+    uint64_t* chunk_offsets;
+    uint64_t* chunk_counts;
+
+    int compression;
+    int predictor;
+    int floating_point;
+    size_t bytes_per_sample;
+
+    // Compressed chunks are appended at data_end in the order they arrive,
+    // data_offset is where the first one goes
+    uint64_t data_offset;
+    uint64_t data_end;
+    pthread_mutex_t append_lock;
+    struct tiff_chunk scratch;
+
+    // The whole file when mapped, pixels are then generated in place
+    uint8_t* map;
+    size_t map_size;
+
+    size_t rows_written;    // Across all pages
+    atomic_size_t chunks_written;
+    atomic_int failed;
+
+    struct tiff_layout layout;
+};
+
+static void tiff_layout_compute(struct tiff_layout* layout, int bigtiff, int number_of_entries,
+                                size_t chunks, int pages, size_t image_data_size) {
+    layout->bigtiff = bigtiff;
+    layout->offset_size = bigtiff ? 8 : 4;
+    layout->header_size = bigtiff ? 16 : 8;
+    layout->ifd_size = bigtiff
+        ? 8 + number_of_entries * sizeof(TiffIFD8Entry) + 8
+        : 2 + number_of_entries * sizeof(TiffIFDEntry) + 4;
+
+    size_t rational_data_offset = layout->header_size + layout->ifd_size;
+    if (rational_data_offset % layout->offset_size != 0) {
+        rational_data_offset += (layout->offset_size - (rational_data_offset % layout->offset_size));
+    }
+    layout->x_res_offset = rational_data_offset;
+    layout->y_res_offset = rational_data_offset + 8;
+
+    // A single chunk keeps its offset and byte count inside the IFD entry,
+    // several chunks need arrays of them after the resolution rationals
+    layout->chunk_offsets_offset = layout->y_res_offset + 8;
+    layout->chunk_counts_offset = layout->chunk_offsets_offset;
+    layout->image_data_offset = layout->chunk_offsets_offset;
+    if (chunks > 1) {
+        layout->chunk_counts_offset = layout->chunk_offsets_offset + chunks * layout->offset_size;
+        layout->image_data_offset = layout->chunk_counts_offset + chunks * layout->offset_size;
+    }
+
+    // Every block ends word aligned, so the next page's IFD starts right there
+    layout->page_size = layout->image_data_offset - layout->header_size;
+    layout->image_data_offset = layout->header_size + layout->page_size * pages;
+    layout->image_data_size = image_data_size;
+}
+
+static void add_field(struct tiff_field* fields, int* count, uint16_t tag, uint16_t type,
+                      uint64_t values, uint64_t value_offset) {
+    fields[*count].tag = tag;
+    fields[*count].type = type;
+    fields[*count].count = values;
+    fields[*count].value_offset = value_offset;
+    (*count)++;
+}
+
+// Collects the IFD entries of a page in ascending tag order as TIFF requires
+static int tiff_collect_fields(const struct tiff_writer* writer, int page, struct tiff_field* fields) {
+    const struct tiff_layout* layout = &writer->layout;
+    uint16_t offset_type = layout->bigtiff ? TIFF_TYPE_LONG8 : TIFF_TYPE_LONG;
+    size_t block = layout->page_size * page;
+    size_t first = writer->page_chunks * page;
+    size_t bits_per_sample = writer->bytes_per_sample * 8;
+    uint64_t sample_format = writer->floating_point ? TIFF_SAMPLE_FORMAT_IEEEFP : TIFF_SAMPLE_FORMAT_UINT;
+    int count = 0;
+
+    // A single chunk stores its offset and size in place of the array offsets
+    int arrays = writer->page_chunks > 1;
+    uint64_t offsets = arrays ? block + layout->chunk_offsets_offset : writer->chunk_offsets[first];
+    uint64_t counts = arrays ? block + layout->chunk_counts_offset : writer->chunk_counts[first];
+
+    add_field(fields, &count, TIFF_TAG_IMAGE_WIDTH, TIFF_TYPE_LONG, 1, (uint32_t) writer->width);
+    add_field(fields, &count, TIFF_TAG_IMAGE_LENGTH, TIFF_TYPE_LONG, 1, (uint32_t) writer->height);
+    add_field(fields, &count, TIFF_TAG_BITS_PER_SAMPLE, TIFF_TYPE_SHORT, 1, bits_per_sample);
+    add_field(fields, &count, TIFF_TAG_COMPRESSION, TIFF_TYPE_SHORT, 1, (uint64_t) writer->compression);
+    add_field(fields, &count, TIFF_TAG_PHOTOMERIC_INTERPRETATION, TIFF_TYPE_SHORT, 1, 1); // value 1 means 0.0 is black
+
+    if (!writer->tiled) {
+        add_field(fields, &count, TIFF_TAG_STRIP_OFFSETS, offset_type, writer->page_chunks, offsets);
     }
 
+    add_field(fields, &count, TIFF_TAG_SAMPLES_PER_PIXEL, TIFF_TYPE_SHORT, 1, 1);
+
+    if (!writer->tiled) {
+        add_field(fields, &count, TIFF_TAG_ROWS_PER_STRIP, TIFF_TYPE_LONG, 1, (uint32_t) writer->rows_per_strip);
+        add_field(fields, &count, TIFF_TAG_STRIP_BYTE_COUNTS, offset_type, writer->page_chunks, counts);
+    }
+
+    add_field(fields, &count, TIFF_TAG_X_RESOLUTION, TIFF_TYPE_RATIONAL, 1, block + layout->x_res_offset);
+    add_field(fields, &count, TIFF_TAG_Y_RESOLUTION, TIFF_TYPE_RATIONAL, 1, block + layout->y_res_offset);
+    add_field(fields, &count, TIFF_TAG_RESOLUTION_UNIT, TIFF_TYPE_SHORT, 1, 1); // No absolute inch / cm unit of measurement
+
+    if (writer->predictor != TIFF_PREDICTOR_NONE) {
+        add_field(fields, &count, TIFF_TAG_PREDICTOR, TIFF_TYPE_SHORT, 1, (uint64_t) writer->predictor);
+    }
+
+    if (writer->tiled) {
+        add_field(fields, &count, TIFF_TAG_TILE_WIDTH, TIFF_TYPE_LONG, 1, (uint32_t) writer->tile_width);
+        add_field(fields, &count, TIFF_TAG_TILE_LENGTH, TIFF_TYPE_LONG, 1, (uint32_t) writer->tile_length);
+        add_field(fields, &count, TIFF_TAG_TILE_OFFSETS, offset_type, writer->page_chunks, offsets);
+        add_field(fields, &count, TIFF_TAG_TILE_BYTE_COUNTS, offset_type, writer->page_chunks, counts);
+    }
+
+    add_field(fields, &count, TIFF_TAG_SAMPLE_FORMAT, TIFF_TYPE_SHORT, 1, sample_format);
+
+    return count;
+}
+
+static void put_bytes(uint8_t* buffer, size_t* pos, const void* data, size_t size) {
+    memcpy(buffer + *pos, data, size);
+    *pos += size;
+}
+
+// Puts an offset sized value, 4 bytes in classic TIFF and 8 in BigTIFF
+static void put_offset(uint8_t* buffer, size_t* pos, int bigtiff, uint64_t value) {
+    if (bigtiff) {
+        put_bytes(buffer, pos, &value, 8);
+    } else {
+        uint32_t value32 = (uint32_t) value;
+        put_bytes(buffer, pos, &value32, 4);
+    }
+}
+
+// Serialises the header, IFD, rationals and chunk arrays, which together take
+// up the first image_data_offset bytes of the file
+static uint8_t* tiff_build_header(const struct tiff_writer* writer) {
+    const struct tiff_layout* layout = &writer->layout;
+    int bigtiff = layout->bigtiff;
+
+    uint8_t* buffer = (uint8_t*) calloc(1, layout->image_data_offset);
+    if (!buffer) {
+        return NULL;
+    }
+
+    size_t pos = 0;
     uint16_t byte_order = TIFF_BYTE_ORDER_LL;
-    fwrite(&byte_order, 2, 1, fhandle);
+    put_bytes(buffer, &pos, &byte_order, 2);
+
+    if (bigtiff) {
+        uint16_t tiff_version = TIFF_VERSION_BIG;
+        uint16_t offset_size = 8;
+        uint16_t reserved = 0;
+        put_bytes(buffer, &pos, &tiff_version, 2);
+        put_bytes(buffer, &pos, &offset_size, 2);
+        put_bytes(buffer, &pos, &reserved, 2);
+    } else {
+        uint16_t tiff_version = TIFF_VERSION;
+        put_bytes(buffer, &pos, &tiff_version, 2);
+    }
+    put_offset(buffer, &pos, bigtiff, layout->header_size); // Right after the header
+
+    uint32_t numerator = (uint32_t) writer->dpi;
+    uint32_t denominator = 1;
+
+    // Every page's IFD points on to the next one, the last ends the chain
+    for (int page = 0; page < writer->pages; page++) {
+        size_t block = layout->page_size * page;
+        size_t first = writer->page_chunks * page;
+
+        struct tiff_field fields[TIFF_MAX_FIELDS];
+        int number_of_entries = tiff_collect_fields(writer, page, fields);
+
+        // Start to write IDF entries
+        pos = layout->header_size + block;
+        if (bigtiff) {
+            uint64_t entries = (uint64_t) number_of_entries;
+            put_bytes(buffer, &pos, &entries, 8);
+        } else {
+            uint16_t entries = (uint16_t) number_of_entries;
+            put_bytes(buffer, &pos, &entries, 2);
+        }
+
+        for (int i = 0; i < number_of_entries; i++) {
+            if (bigtiff) {
+                TiffIFD8Entry entry;
+                entry.tag = fields[i].tag;
+                entry.type = fields[i].type;
+                entry.count = fields[i].count;
+                entry.value_offset = fields[i].value_offset;
+                put_bytes(buffer, &pos, &entry, sizeof(TiffIFD8Entry));
+            } else {
+                TiffIFDEntry entry;
+                entry.tag = fields[i].tag;
+                entry.type = fields[i].type;
+                entry.count = (uint32_t) fields[i].count;
+                entry.value_offset = (uint32_t) fields[i].value_offset;
+                put_bytes(buffer, &pos, &entry, sizeof(TiffIFDEntry));
+            }
+        }
+
+        uint64_t next_ifd = page + 1 < writer->pages ? layout->header_size + block + layout->page_size : 0;
+        put_offset(buffer, &pos, bigtiff, next_ifd);
+
+        pos = block + layout->x_res_offset;
+        put_bytes(buffer, &pos, &numerator, 4);
+        put_bytes(buffer, &pos, &denominator, 4);
+
+        pos = block + layout->y_res_offset;
+        put_bytes(buffer, &pos, &numerator, 4);
+        put_bytes(buffer, &pos, &denominator, 4);
+
+        if (writer->page_chunks > 1) {
+            pos = block + layout->chunk_offsets_offset;
+            for (size_t i = first; i < first + writer->page_chunks; i++) {
+                put_offset(buffer, &pos, bigtiff, writer->chunk_offsets[i]);
+            }
+            for (size_t i = first; i < first + writer->page_chunks; i++) {
+                put_offset(buffer, &pos, bigtiff, writer->chunk_counts[i]);
+            }
+        }
+    }
 
-    uint16_t tiff_version = TIFF_VERSION;
-    fwrite(&tiff_version, 2, 1, fhandle);
+    return buffer;
+}
 
-    uint32_t tiff_data_offset = 8; // Right after the header
-    fwrite(&tiff_data_offset, 4, 1, fhandle);
+static int pwrite_all(int fd, const void* data, size_t size, uint64_t offset) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, (off_t) offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        size -= (size_t) written;
+        offset += (uint64_t) written;
+    }
+    return 0;
+}
 
-    size_t ifd_start_offset = 8;
-    uint16_t number_of_entries = 13;
-    //size_t ifd_size = number_of_entries * sizeof(TiffIFDEntry);
-    size_t ifd_size = 2 + number_of_entries * sizeof(TiffIFDEntry) + 4;
+struct tiff_writer* tiff_writer_open(const char* filename, int width, int height, const struct tiff_options* options) {
+    int compression = options->compression ? (int) options->compression : TIFF_COMPRESSION_NONE;
+    if (compression != TIFF_COMPRESSION_NONE && compression != TIFF_COMPRESSION_LZW &&
+        compression != TIFF_COMPRESSION_DEFLATE && compression != TIFF_COMPRESSION_PACKBITS) {
+        fprintf(stderr, "Unknown compression %d\n", compression);
+        return NULL;
+    }
+    if (options->predictor && compression != TIFF_COMPRESSION_LZW && compression != TIFF_COMPRESSION_DEFLATE) {
+        fprintf(stderr, "The predictor needs LZW or Deflate compression\n");
+        return NULL;
+    }
+    if (options->mapped && compression != TIFF_COMPRESSION_NONE) {
+        fprintf(stderr, "Only uncompressed images can be mapped\n");
+        return NULL;
+    }
 
-    size_t rational_data_offset = ifd_start_offset + ifd_size;
-    if (rational_data_offset % 4 != 0) {
-        rational_data_offset += (4 - (rational_data_offset % 4));
+    struct tiff_writer* writer = (struct tiff_writer*) calloc(1, sizeof(struct tiff_writer));
+    if (!writer) {
+        return NULL;
     }
-    size_t x_res_offset = rational_data_offset;
-    size_t y_res_offset = rational_data_offset + 8;
-    size_t image_data_offset = y_res_offset + 8;
-    size_t bits_per_sample = 8; // Floats size
-    size_t bytes_per_sample = bits_per_sample / 8;
 
-    size_t image_data_size = (size_t) (width * height * bytes_per_sample);
+    writer->width = width;
+    writer->height = height;
+    writer->dpi = options->dpi;
+    writer->pages = options->pages > 1 ? options->pages : 1;
+    writer->compression = compression;
+    writer->floating_point = options->sample_format == TIFF_SAMPLE_FLOAT;
+    writer->bytes_per_sample = options->sample_format == TIFF_SAMPLE_UINT16 ? 2
+        : options->sample_format == TIFF_SAMPLE_FLOAT ? 4 : 1;
+
+    // Floats have their own predictor, plain differencing of them does not
+    // help much
+    writer->predictor = TIFF_PREDICTOR_NONE;
+    if (options->predictor) {
+        writer->predictor = writer->floating_point ? TIFF_PREDICTOR_FLOAT : TIFF_PREDICTOR_HORIZONTAL;
+    }
 
-    fseek(fhandle, ifd_start_offset, SEEK_SET);
+    size_t bytes_per_sample = writer->bytes_per_sample;
+
+    if (options->tile_width > 0 && options->tile_length > 0) {
+        if (options->tile_width % 16 != 0 || options->tile_length % 16 != 0) {
+            fprintf(stderr, "Tile sizes must be multiples of 16\n");
+            free(writer);
+            return NULL;
+        }
+        writer->tiled = 1;
+        writer->tile_width = options->tile_width;
+        writer->tile_length = options->tile_length;
+        writer->page_chunks = tiff_writer_tiles(writer);
+        writer->chunk_size = (size_t) writer->tile_width * writer->tile_length * bytes_per_sample;
+    } else {
+        writer->rows_per_strip = options->rows_per_strip;
+        if (writer->rows_per_strip <= 0 || writer->rows_per_strip > height) {
+            writer->rows_per_strip = height;
+        }
+        writer->page_chunks = (size_t) (height + writer->rows_per_strip - 1) / writer->rows_per_strip;
+        writer->chunk_size = (size_t) width * writer->rows_per_strip * bytes_per_sample;
+    }
+    writer->chunks = writer->page_chunks * writer->pages;
+
+    writer->chunk_offsets = (uint64_t*) calloc(writer->chunks, sizeof(uint64_t));
+    writer->chunk_counts = (uint64_t*) calloc(writer->chunks, sizeof(uint64_t));
+    if (!writer->chunk_offsets || !writer->chunk_counts) {
+        free(writer->chunk_offsets);
+        free(writer->chunk_counts);
+        free(writer);
+        return NULL;
+    }
+
+    // Edge tiles are padded to full size, only the last strip of a page is
+    // shorter. Pages are stored one after the other.
+    size_t page_data_size = writer->page_chunks * writer->chunk_size;
+    if (!writer->tiled) {
+        page_data_size = (size_t) width * height * bytes_per_sample;
+    }
+    size_t image_data_size = page_data_size * writer->pages;
+
+    // Classic TIFF offsets are 32 bit, anything that would end past 4 GiB
+    // has to be written as BigTIFF
+    struct tiff_field fields[TIFF_MAX_FIELDS];
+    int number_of_entries = tiff_collect_fields(writer, 0, fields);
+    tiff_layout_compute(&writer->layout, 0, number_of_entries, writer->page_chunks, writer->pages, image_data_size);
+
+    if (writer->compression != TIFF_COMPRESSION_NONE) {
+        // The compressed size is only known at close, room for the larger
+        // BigTIFF header block keeps both choices open until then
+        struct tiff_layout big;
+        tiff_layout_compute(&big, 1, number_of_entries, writer->page_chunks, writer->pages, image_data_size);
+        writer->data_offset = big.image_data_offset;
+    } else {
+        if (writer->layout.image_data_offset + image_data_size > UINT32_MAX) {
+            tiff_layout_compute(&writer->layout, 1, number_of_entries, writer->page_chunks, writer->pages, image_data_size);
+        }
+        writer->data_offset = writer->layout.image_data_offset;
+
+        for (size_t i = 0; i < writer->chunks; i++) {
+            size_t page = i / writer->page_chunks;
+            size_t chunk = i % writer->page_chunks;
+            writer->chunk_offsets[i] = writer->data_offset + page * page_data_size + chunk * writer->chunk_size;
+            writer->chunk_counts[i] = writer->chunk_size;
+            if (!writer->tiled && chunk == writer->page_chunks - 1) {
+                writer->chunk_counts[i] = page_data_size - chunk * writer->chunk_size;
+            }
+        }
+    }
+    writer->data_end = writer->data_offset;
+
+    // A shared writable mapping needs the file open for reading too
+    writer->fd = open(filename, (options->mapped ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0) {
+        perror("Could not open file for writing");
+        free(writer->chunk_offsets);
+        free(writer->chunk_counts);
+        free(writer);
+        return NULL;
+    }
+
+    if (options->mapped) {
+        // The file gets its final size up front, pages the caller never
+        // touches read back as zero, which is what tile padding needs anyway
+        writer->map_size = writer->data_offset + image_data_size;
+        if (ftruncate(writer->fd, (off_t) writer->map_size) != 0) {
+            perror("Could not size image file");
+            writer->map_size = 0;
+        } else {
+            writer->map = (uint8_t*) mmap(NULL, writer->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, writer->fd, 0);
+            if (writer->map == MAP_FAILED) {
+                perror("Could not map image file");
+                writer->map = NULL;
+            }
+        }
+        if (!writer->map) {
+            close(writer->fd);
+            free(writer->chunk_offsets);
+            free(writer->chunk_counts);
+            free(writer);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&writer->append_lock, NULL);
+
+    return writer;
+}
+
+uint8_t* tiff_writer_mapped_data(struct tiff_writer* writer) {
+    return writer->map ? writer->map + writer->data_offset : NULL;
+}
 
-    // Start to write IDF entries
-    fwrite(&number_of_entries, 2, 1, fhandle);
+size_t tiff_writer_tiles(const struct tiff_writer* writer) {
+    if (!writer->tiled) {
+        return 0;
+    }
+    size_t across = (size_t) (writer->width + writer->tile_width - 1) / writer->tile_width;
+    size_t down = (size_t) (writer->height + writer->tile_length - 1) / writer->tile_length;
+    return across * down;
+}
 
-    TiffIFDEntry entry;
-    entry.count = 1;
+// Grows a buffer to at least size bytes, keeping what is already there
+static int reserve_buffer(uint8_t** buffer, size_t* capacity, size_t size) {
+    if (*capacity >= size) {
+        return 0;
+    }
+    uint8_t* grown = (uint8_t*) realloc(*buffer, size);
+    if (!grown) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    *buffer = grown;
+    *capacity = size;
+    return 0;
+}
 
-    entry.tag = TIFF_TAG_IMAGE_WIDTH;
-    entry.type = TIFF_TYPE_LONG;
-    entry.value_offset = (uint32_t) width;
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+void tiff_chunk_free(struct tiff_chunk* chunk) {
+    free(chunk->data);
+    free(chunk->work);
+    memset(chunk, 0, sizeof(struct tiff_chunk));
+}
 
-    entry.tag = TIFF_TAG_IMAGE_LENGTH;
-    entry.type = TIFF_TYPE_LONG;
-    entry.value_offset = (uint32_t) height;
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+int tiff_writer_encode(const struct tiff_writer* writer, size_t index, const void* samples, struct tiff_chunk* chunk) {
+    const uint8_t* data = (const uint8_t*) samples;
 
-    entry.tag = TIFF_TAG_BITS_PER_SAMPLE;
-    entry.type = TIFF_TYPE_SHORT;
-    entry.value_offset = (uint32_t) bits_per_sample;
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+    if (index >= writer->chunks) {
+        fprintf(stderr, "No chunk %zu in image\n", index);
+        return -1;
+    }
 
-    entry.tag = TIFF_TAG_COMPRESSION;
-    entry.type = TIFF_TYPE_SHORT;
-    entry.value_offset = 1; // No compression
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+    // Tiles are always full size, the last strip of a page may be short
+    size_t row_size = (writer->tiled ? (size_t) writer->tile_width : (size_t) writer->width) * writer->bytes_per_sample;
+    size_t size = writer->chunk_size;
+    if (!writer->tiled) {
+        size_t strip = index % writer->page_chunks;
+        size_t rows = (size_t) writer->height - strip * writer->rows_per_strip;
+        if (rows < (size_t) writer->rows_per_strip) {
+            size = rows * row_size;
+        }
+    }
 
-    entry.tag = TIFF_TAG_PHOTOMERIC_INTERPRETATION;
-    entry.type = TIFF_TYPE_SHORT;
-    entry.value_offset = 1; // value 1 means 0.0 is black
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+    // The predictor works on a copy, the caller's samples stay untouched.
+    // The float predictor needs another row behind it to shuffle bytes in.
+    if (writer->predictor != TIFF_PREDICTOR_NONE) {
+        if (reserve_buffer(&chunk->work, &chunk->work_capacity, size + row_size) < 0) {
+            return -1;
+        }
+        memcpy(chunk->work, data, size);
+        if (writer->predictor == TIFF_PREDICTOR_FLOAT) {
+            float_predictor_encode(chunk->work, size, row_size, chunk->work + size);
+        } else {
+            predictor_encode(chunk->work, size, row_size, writer->bytes_per_sample);
+        }
+        data = chunk->work;
+    }
 
+    size_t bound = size;
+    switch (writer->compression) {
+    case TIFF_COMPRESSION_PACKBITS:
+        bound = packbits_bound(size, row_size);
+        break;
+    case TIFF_COMPRESSION_LZW:
+        bound = lzw_bound(size);
+        break;
+    case TIFF_COMPRESSION_DEFLATE:
+        bound = deflate_bound(size);
+        break;
+    }
+    if (reserve_buffer(&chunk->data, &chunk->capacity, bound) < 0) {
+        return -1;
+    }
 
-    entry.tag = TIFF_TAG_STRIP_OFFSETS;
-    entry.type = TIFF_TYPE_LONG;
-    entry.value_offset = (uint32_t) image_data_offset;
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+    switch (writer->compression) {
+    case TIFF_COMPRESSION_PACKBITS:
+        chunk->size = packbits_encode(data, size, row_size, chunk->data);
+        break;
+    case TIFF_COMPRESSION_LZW:
+        chunk->size = lzw_encode(data, size, chunk->data);
+        break;
+    case TIFF_COMPRESSION_DEFLATE:
+        chunk->size = deflate_encode(data, size, chunk->data, chunk->capacity, TIFF_DEFLATE_LEVEL);
+        break;
+    default:
+        memcpy(chunk->data, data, size);
+        chunk->size = size;
+        break;
+    }
 
-    entry.tag = TIFF_TAG_SAMPLES_PER_PIXEL;
-    entry.type = TIFF_TYPE_SHORT;
-    entry.value_offset = 1;
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+    if (chunk->size == 0) {
+        fprintf(stderr, "Could not compress image chunk %zu\n", index);
+        return -1;
+    }
+    return 0;
+}
 
-    entry.tag = TIFF_TAG_ROWS_PER_STRIP;
-    entry.type = TIFF_TYPE_LONG;
-    entry.value_offset = (uint32_t) height;
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+int tiff_writer_append(struct tiff_writer* writer, size_t index, const struct tiff_chunk* chunk) {
+    if (index >= writer->chunks) {
+        fprintf(stderr, "No chunk %zu in image\n", index);
+        return -1;
+    }
 
-    entry.tag = TIFF_TAG_STRIP_BYTE_COUNTS;
-    entry.type = TIFF_TYPE_LONG;
-    entry.value_offset = (uint32_t) image_data_size;
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+    // Uncompressed chunks still have their precomputed place
+    int compressed = writer->compression != TIFF_COMPRESSION_NONE;
+    uint64_t offset = compressed ? writer->data_end : writer->chunk_offsets[index];
 
+    if (pwrite_all(writer->fd, chunk->data, chunk->size, offset) < 0) {
+        perror("Could not write image data");
+        atomic_store(&writer->failed, 1);
+        return -1;
+    }
 
-    entry.tag = TIFF_TAG_X_RESOLUTION;
-    entry.type = TIFF_TYPE_RATIONAL;
-    entry.value_offset = (uint32_t) x_res_offset;
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+    if (compressed) {
+        writer->chunk_offsets[index] = offset;
+        writer->chunk_counts[index] = chunk->size;
+        writer->data_end += chunk->size;
+    }
 
-    entry.tag = TIFF_TAG_Y_RESOLUTION;
-    entry.type = TIFF_TYPE_RATIONAL;
-    entry.value_offset = (uint32_t) y_res_offset;
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+    atomic_fetch_add(&writer->chunks_written, 1);
+    return 0;
+}
 
-    entry.tag = TIFF_TAG_RESOLUTION_UNIT;
-    entry.type = TIFF_TYPE_SHORT;
-    entry.value_offset = 1; // No absolute inch / cm unit of measurement
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+int tiff_writer_write_rows(struct tiff_writer* writer, const void* samples, int rows) {
+    const uint8_t* data = (const uint8_t*) samples;
+    size_t row_size = (size_t) writer->width * writer->bytes_per_sample;
+    size_t total_rows = (size_t) writer->height * writer->pages;
 
-    entry.tag = TIFF_TAG_SAMPLE_FORMAT;
-    entry.type = TIFF_TYPE_SHORT;
-    entry.value_offset = 1; // unsigned int
-    fwrite(&entry, sizeof(TiffIFDEntry), 1, fhandle);
+    if (writer->tiled || rows < 0 || (size_t) rows > total_rows - writer->rows_written) {
+        fprintf(stderr, "Too many rows written to image\n");
+        return -1;
+    }
 
-    uint32_t next_ifd = 0;
-    fwrite(&next_ifd, 4, 1, fhandle);
+    if (writer->compression != TIFF_COMPRESSION_NONE) {
+        // Strips are compressed as a whole, so they can not be split up
+        // between calls
+        size_t row = 0;
+        while (row < (size_t) rows) {
+            size_t page = (writer->rows_written + row) / writer->height;
+            size_t page_row = (writer->rows_written + row) % writer->height;
+            size_t strip_rows = writer->height - page_row < (size_t) writer->rows_per_strip
+                ? writer->height - page_row
+                : (size_t) writer->rows_per_strip;
+
+            if (page_row % writer->rows_per_strip != 0 || row + strip_rows > (size_t) rows) {
+                fprintf(stderr, "Compressed images are written in whole strips\n");
+                return -1;
+            }
+
+            size_t strip = page * writer->page_chunks + page_row / writer->rows_per_strip;
+            if (tiff_writer_encode(writer, strip, data + row_size * row, &writer->scratch) < 0 ||
+                tiff_writer_append(writer, strip, &writer->scratch) < 0) {
+                atomic_store(&writer->failed, 1);
+                return -1;
+            }
+            row += strip_rows;
+        }
+
+        writer->rows_written += (size_t) rows;
+        return 0;
+    }
 
-    uint32_t numerator = (uint32_t) dpi;
-    uint32_t denominator = 1;
+    // Strips and pages are stored back to back, so rows go straight after
+    // each other
+    size_t count = row_size * rows;
+    uint64_t offset = writer->data_offset + (uint64_t) row_size * writer->rows_written;
+    if (pwrite_all(writer->fd, data, count, offset) < 0) {
+        perror("Could not write image data");
+        atomic_store(&writer->failed, 1);
+        return -1;
+    }
 
-    fseek(fhandle, x_res_offset, SEEK_SET);
-    fwrite(&numerator, 4, 1, fhandle);
-    fwrite(&denominator, 4, 1, fhandle);
+    // Only whole strips count, a page's short last one once the page is done
+    writer->rows_written += (size_t) rows;
+    size_t pages_done = writer->rows_written / writer->height;
+    size_t page_row = writer->rows_written % writer->height;
+    atomic_store(&writer->chunks_written, pages_done * writer->page_chunks + page_row / writer->rows_per_strip);
+    return 0;
+}
 
-    numerator = (uint32_t) dpi;
-    fseek(fhandle, y_res_offset, SEEK_SET);
-    fwrite(&numerator, 4, 1, fhandle);
-    fwrite(&denominator, 4, 1, fhandle);
+int tiff_writer_write_tile(struct tiff_writer* writer, size_t tile, const void* data) {
+    if (!writer->tiled || tile >= writer->chunks) {
+        fprintf(stderr, "No tile %zu in image\n", tile);
+        return -1;
+    }
 
-    fseek(fhandle, image_data_offset, SEEK_SET);
-    fwrite(data, bytes_per_sample, (size_t) width * height, fhandle);
+    // Compressed tiles go wherever the file ends when they are done, in
+    // whatever order the threads finish them
+    if (writer->compression != TIFF_COMPRESSION_NONE) {
+        struct tiff_chunk chunk = {0};
+        int result = tiff_writer_encode(writer, tile, data, &chunk);
+        if (result == 0) {
+            pthread_mutex_lock(&writer->append_lock);
+            result = tiff_writer_append(writer, tile, &chunk);
+            pthread_mutex_unlock(&writer->append_lock);
+        }
+        if (result < 0) {
+            atomic_store(&writer->failed, 1);
+        }
+        tiff_chunk_free(&chunk);
+        return result;
+    }
 
-    fclose(fhandle);
+    // Every tile has its own precomputed place, so writers never contend
+    if (pwrite_all(writer->fd, data, writer->chunk_size, writer->chunk_offsets[tile]) < 0) {
+        perror("Could not write image tile");
+        atomic_store(&writer->failed, 1);
+        return -1;
+    }
 
+    atomic_fetch_add(&writer->chunks_written, 1);
     return 0;
 }
+
+int tiff_writer_close(struct tiff_writer* writer) {
+    int result = atomic_load(&writer->failed) ? -1 : 0;
+
+    // Pixels of a mapped file are put in place by the caller, there is
+    // nothing to count
+    size_t written = atomic_load(&writer->chunks_written);
+    if (!writer->map && written != writer->chunks) {
+        fprintf(stderr, "Image closed after %zu of %zu %s\n", written, writer->chunks,
+                writer->tiled ? "tiles" : "strips");
+        result = -1;
+    }
+
+    // Now the compressed size is known, go BigTIFF only if it is needed.
+    // Either header block fits in the room left in front of the data.
+    if (writer->compression != TIFF_COMPRESSION_NONE) {
+        struct tiff_field fields[TIFF_MAX_FIELDS];
+        int number_of_entries = tiff_collect_fields(writer, 0, fields);
+        size_t image_data_size = writer->data_end - writer->data_offset;
+        tiff_layout_compute(&writer->layout, writer->data_end > UINT32_MAX, number_of_entries,
+                            writer->page_chunks, writer->pages, image_data_size);
+    }
+
+    // The header goes in last, a file cut short never looks complete
+    uint8_t* header = tiff_build_header(writer);
+    if (!header || pwrite_all(writer->fd, header, writer->layout.image_data_offset, 0) < 0) {
+        perror("Could not write image header");
+        result = -1;
+    }
+    free(header);
+
+    if (writer->map && munmap(writer->map, writer->map_size) != 0) {
+        perror("Could not unmap image file");
+        result = -1;
+    }
+
+    if (close(writer->fd) != 0) {
+        perror("Could not close image file");
+        result = -1;
+    }
+
+    pthread_mutex_destroy(&writer->append_lock);
+    tiff_chunk_free(&writer->scratch);
+    free(writer->chunk_offsets);
+    free(writer->chunk_counts);
+    free(writer);
+    return result;
+}
+
+int write_image_to_ttf(const uint8_t* data, int width, int height, float dpi, const char* filename) {
+    struct tiff_options options = {
+        .dpi = dpi,
+        .rows_per_strip = height,
+    };
+
+    struct tiff_writer* writer = tiff_writer_open(filename, width, height, &options);
+    if (!writer) {
+        return -1;
+    }
+
+    if (tiff_writer_write_rows(writer, data, height) < 0) {
+        tiff_writer_close(writer);
+        return -1;
+    }
+
+    return tiff_writer_close(writer);
+}
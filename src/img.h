@@ -1,8 +1,117 @@
 #ifndef IMG_H_
 #define IMG_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+/*
+** Streaming TIFF writer
+**
+** The image is stored either in strips of rows_per_strip rows or in tiles of
+** tile_width x tile_length pixels. Strips are handed over in order through
+** tiff_writer_write_rows in chunks of any size. Tiles go through
+** tiff_writer_write_tile in any order and from any thread, each tile of an
+** uncompressed image has a precomputed place in the file and is written
+** there with pwrite.
+** Either way only the data being written has to be held in memory.
+**
+** Files that would end past 4 GiB are written as BigTIFF (version 43 with
+** 64 bit offsets), everything else as classic TIFF.
+**
+** Compressed strips and tiles have no size known up front. They are encoded
+** independently, possibly on many threads at once, with tiff_writer_encode
+** and then stored back to back with tiff_writer_append, the offsets are
+** collected as they arrive and written with the header at close. Appending
+** in chunk order gives the same file however the encoding was spread out.
+** Whether a compressed file needs BigTIFF is only decided at close, once its
+** real size is known.
+**
+** A file can hold several pages of the same size and format, their IFDs are
+** chained in page order. Strips and tiles are numbered across pages, so
+** chunk c of page p is chunk p * chunks per page + c, and rows handed to
+** tiff_writer_write_rows run on from one page into the next.
+**
+** An uncompressed file can also be mapped. It is sized to its final length
+** at open and tiff_writer_mapped_data hands out the pixel region of the
+** mapping, so pixels are generated straight into the page cache without an
+** intermediate buffer or a copy.
+*/
+
+// Values are the TIFF Compression tag values
+enum tiff_compression {
+    TIFF_COMPRESSION_NONE = 1,
+    TIFF_COMPRESSION_LZW = 5,
+    TIFF_COMPRESSION_DEFLATE = 8,
+    TIFF_COMPRESSION_PACKBITS = 32773,
+};
+
+// Noise values are stored either quantized to unsigned integers or as they
+// are in 32 bit IEEE floats
+enum tiff_sample_format {
+    TIFF_SAMPLE_UINT8,
+    TIFF_SAMPLE_UINT16,
+    TIFF_SAMPLE_FLOAT,
+};
+
+struct tiff_options {
+    float dpi;
+    // Strip layout, <= 0 stores the whole image as a single strip
+    int rows_per_strip;
+    // Tiled layout when both are > 0, must be multiples of 16
+    int tile_width;
+    int tile_length;
+    // 0 is the same as TIFF_COMPRESSION_NONE
+    enum tiff_compression compression;
+    // Differencing before LZW or Deflate, helps smooth images. Integer
+    // samples use the horizontal predictor, floats the floating point one.
+    int predictor;
+    enum tiff_sample_format sample_format;
+    // Map the file instead of writing it, uncompressed images only
+    int mapped;
+    // Number of pages, <= 1 is a single image
+    int pages;
+};
+
+// An encoded strip or tile, the buffers are kept between encodes
+struct tiff_chunk {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    uint8_t* work;
+    size_t work_capacity;
+};
+
+void tiff_chunk_free(struct tiff_chunk* chunk);
+
+struct tiff_writer;
+
+struct tiff_writer* tiff_writer_open(const char* filename, int width, int height, const struct tiff_options* options);
+// Samples are in the writer's sample format and in host byte order, which
+// has to be little endian
+int tiff_writer_write_rows(struct tiff_writer* writer, const void* data, int rows);
+
+// Tiles per page, numbered row by row. data is always a full tile_width x
+// tile_length tile, edge tiles are padded.
+size_t tiff_writer_tiles(const struct tiff_writer* writer);
+int tiff_writer_write_tile(struct tiff_writer* writer, size_t tile, const void* data);
+
+// Encodes strip or tile `index` from raw samples, a strip holds its rows of
+// the image and a tile is padded to full size. Safe to call from any number
+// of threads at once as long as each uses its own chunk.
+int tiff_writer_encode(const struct tiff_writer* writer, size_t index, const void* data, struct tiff_chunk* chunk);
+// Stores an encoded chunk behind everything appended so far, calls must not
+// overlap each other
+int tiff_writer_append(struct tiff_writer* writer, size_t index, const struct tiff_chunk* chunk);
+
+// Image data of a mapped file, strips back to back or whole tiles in tile
+// order, page after page, NULL when the writer is not mapped. Any thread may fill any part
+// of it, the header is added at close.
+uint8_t* tiff_writer_mapped_data(struct tiff_writer* writer);
+
+// Writes the header and IFD, fails if the image was not completely written
+int tiff_writer_close(struct tiff_writer* writer);
+
+// Writes a whole image held in memory as a single strip
 int write_image_to_ttf(const uint8_t* data, int width, int height, float dpi, const char* filename);
 
 #endif // IMG_H_
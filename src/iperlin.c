@@ -1,36 +1,8 @@
 #include "iperlin.h"
+#include "iperlin_simd.h"
 
 #include <math.h>
-
-// Permutation table
-static const int p[] = { 151,160,137,91,90,15,
-   131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
-   190, 6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,
-   88,237,149,56,87,174,20,125,136,171,168, 68,175,74,165,71,134,139,48,27,166,
-   77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,
-   102,143,54, 65,25,63,161, 1,216,80,73,209,76,132,187,208, 89,18,169,200,196,
-   135,130,116,188,159,86,164,100,109,198,173,186, 3,64,52,217,226,250,124,123,
-   5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,
-   223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167, 43,172,9,
-   129,22,39,253, 19,98,108,110,79,113,224,232,178,185, 112,104,218,246,97,228,
-   251,34,242,193,238,210,144,12,191,179,162,241, 81,51,145,235,249,14,239,107,
-   49,192,214, 31,181,199,106,157,184, 84,204,176,115,121,50,45,127, 4,150,254,
-   138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180,
-   // Repated
-   151,160,137,91,90,15,
-   131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
-   190, 6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,
-   88,237,149,56,87,174,20,125,136,171,168, 68,175,74,165,71,134,139,48,27,166,
-   77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,
-   102,143,54, 65,25,63,161, 1,216,80,73,209,76,132,187,208, 89,18,169,200,196,
-   135,130,116,188,159,86,164,100,109,198,173,186, 3,64,52,217,226,250,124,123,
-   5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,
-   223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167, 43,172,9,
-   129,22,39,253, 19,98,108,110,79,113,224,232,178,185, 112,104,218,246,97,228,
-   251,34,242,193,238,210,144,12,191,179,162,241, 81,51,145,235,249,14,239,107,
-   49,192,214, 31,181,199,106,157,184, 84,204,176,115,121,50,45,127, 4,150,254,
-   138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180
-   };
+#include <stdint.h>
 
 double fade(double t) {
     return t * t * t * (t * (t * 6 - 15) + 10);
@@ -47,8 +19,423 @@ double grad(int hash, double x, double y, double z) {
     return ((h&1) == 0 ? u : -u) + ((h&2) == 0 ? v : -v);
 }
 
+// Lattice corners are looked up in p, one table of a noyc_context
+static inline double iperlin3(const uint8_t* p, double x, double y, double z) {
+    int X = (int)floor(x) & 255;
+    int Y = (int)floor(y) & 255;
+    int Z = (int)floor(z) & 255;
+
+    x -= floor(x);
+    y -= floor(y);
+    z -= floor(z);
+
+    double u = fade(x);
+    double v = fade(y);
+    double w = fade(z);
+
+    int A = noyc_perm(p, X) + Y;
+    int AA = noyc_perm(p, A) + Z;
+    int AB = noyc_perm(p, A+1) + Z;
+    int B = noyc_perm(p, X+1) + Y;
+    int BA = noyc_perm(p, B) + Z;
+    int BB = noyc_perm(p, B+1) + Z;
+
+    return lerp(w, lerp(v, lerp(u, grad((double) noyc_perm(p, AA), x   , y   , z   ),
+                                   grad((double) noyc_perm(p, BA), x-1., y   , z   )),
+                           lerp(u, grad((double) noyc_perm(p, AB), x   , y-1., z   ),
+                                   grad((double) noyc_perm(p, BB), x-1., y-1., z   ))),
+                   lerp(v, lerp(u, grad((double) noyc_perm(p, AA+1), x   , y   , z-1.),
+                                   grad((double) noyc_perm(p, BA+1), x-1., y   , z-1. )),
+                           lerp(u, grad((double) noyc_perm(p, AB+1), x   , y-1., z-1.),
+                                   grad((double) noyc_perm(p, BB+1), x-1., y-1., z-1.))));
+}
+
 double iperlin_at(double x, double y, double z) {
+    return iperlin_ctx_at(&noyc_default_context, x, y, z);
+}
+
+double iperlin_ctx_at(const struct noyc_context* context, double x, double y, double z) {
+    return iperlin3(noyc_context_perm(context, 0), x, y, z);
+}
+
+double octave_iperlin_at(double x, double y, double z, int octaves, double persistence, double bfreq, double bamp) {
+    return octave_iperlin_ctx_at(&noyc_default_context, x, y, z, octaves, persistence, bfreq, bamp);
+}
+
+double octave_iperlin_ctx_at(const struct noyc_context* context, double x, double y, double z, int octaves,
+                             double persistence, double bfreq, double bamp) {
+    double total = 0.0;
+    double frequency = bfreq;
+    double amplitude = bamp;
+    double max_value = 0.0;
+
+    for (int i = 0; i < octaves; i++) {
+        total += iperlin3(noyc_context_perm(context, i), x * frequency, y * frequency, z * frequency) * amplitude;
+        max_value += amplitude;
+
+        amplitude *= persistence;
+        frequency *= 2;
+    }
+
+    return total / max_value;
+}
+
+static void perm_at_n(const uint8_t* p, const double* x, const double* y, const double* z, double* out, size_t n) {
+    size_t done = 0;
+
+    iperlin_kernel kernel = iperlin_select_kernel();
+    if (kernel) {
+        done = kernel(p, x, y, z, out, n);
+    }
+
+    // Whatever does not fill a whole vector goes through the scalar path
+    for (size_t i = done; i < n; i++) {
+        out[i] = iperlin3(p, x[i], y[i], z[i]);
+    }
+}
+
+void iperlin_at_n(const double* x, const double* y, const double* z, double* out, size_t n) {
+    perm_at_n(noyc_context_perm(&noyc_default_context, 0), x, y, z, out, n);
+}
+
+void iperlin_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                      double* out, size_t n) {
+    perm_at_n(noyc_context_perm(context, 0), x, y, z, out, n);
+}
+
+// Points are processed in chunks so the scaled coordinates stay in cache
+#define OCTAVE_CHUNK 256
+
+void octave_iperlin_at_n(const double* x, const double* y, const double* z, double* out, size_t n,
+                         int octaves, double persistence, double bfreq, double bamp) {
+    octave_iperlin_ctx_at_n(&noyc_default_context, x, y, z, out, n, octaves, persistence, bfreq, bamp);
+}
+
+void octave_iperlin_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                             double* out, size_t n, int octaves, double persistence, double bfreq, double bamp) {
+    double sx[OCTAVE_CHUNK];
+    double sy[OCTAVE_CHUNK];
+    double sz[OCTAVE_CHUNK];
+    double value[OCTAVE_CHUNK];
+    double total[OCTAVE_CHUNK];
+
+    for (size_t start = 0; start < n; start += OCTAVE_CHUNK) {
+        size_t count = n - start < OCTAVE_CHUNK ? n - start : OCTAVE_CHUNK;
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (size_t i = 0; i < count; i++) {
+            total[i] = 0.0;
+        }
+
+        for (int o = 0; o < octaves; o++) {
+            for (size_t i = 0; i < count; i++) {
+                sx[i] = x[start + i] * frequency;
+                sy[i] = y[start + i] * frequency;
+                sz[i] = z[start + i] * frequency;
+            }
+
+            perm_at_n(noyc_context_perm(context, o), sx, sy, sz, value, count);
+
+            for (size_t i = 0; i < count; i++) {
+                total[i] += value[i] * amplitude;
+            }
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            out[start + i] = total[i] / max_value;
+        }
+    }
+}
+
+// Per cell state of the grid walker, corner gradients reduced to c + k * x
+struct grid_cell {
+    double k[8];
+    double c[8];
+};
+
+// Gradient of a corner with y and z fixed, as a constant plus a multiple of x
+static void grid_corner(int hash, double y, double z, double* k, double* c) {
+    int h = hash & 15;
+    if (h < 8) {
+        *k = (h&1) == 0 ? 1.0 : -1.0;
+        double v = h<4 ? y : z;
+        *c = (h&2) == 0 ? v : -v;
+    } else if (h == 12 || h == 14) {
+        *k = (h&2) == 0 ? 1.0 : -1.0;
+        *c = (h&1) == 0 ? y : -y;
+    } else {
+        *k = 0.0;
+        *c = ((h&1) == 0 ? y : -y) + ((h&2) == 0 ? z : -z);
+    }
+}
+
+static void grid_cell_setup(struct grid_cell* cell, const uint8_t* p, int X, int Y, int Z, double y, double z) {
+    int A = noyc_perm(p, X) + Y;
+    int AA = noyc_perm(p, A) + Z;
+    int AB = noyc_perm(p, A+1) + Z;
+    int B = noyc_perm(p, X+1) + Y;
+    int BA = noyc_perm(p, B) + Z;
+    int BB = noyc_perm(p, B+1) + Z;
+
+    grid_corner(noyc_perm(p, AA), y   , z   , &cell->k[0], &cell->c[0]);
+    grid_corner(noyc_perm(p, BA), y   , z   , &cell->k[1], &cell->c[1]);
+    grid_corner(noyc_perm(p, AB), y-1., z   , &cell->k[2], &cell->c[2]);
+    grid_corner(noyc_perm(p, BB), y-1., z   , &cell->k[3], &cell->c[3]);
+    grid_corner(noyc_perm(p, AA+1), y   , z-1., &cell->k[4], &cell->c[4]);
+    grid_corner(noyc_perm(p, BA+1), y   , z-1., &cell->k[5], &cell->c[5]);
+    grid_corner(noyc_perm(p, AB+1), y-1., z-1., &cell->k[6], &cell->c[6]);
+    grid_corner(noyc_perm(p, BB+1), y-1., z-1., &cell->k[7], &cell->c[7]);
+}
+
+// Evaluates samples start..end-1 of a row that all share one lattice cell,
+// column first + i of the grid row lands in total[i].
+// Cloned per ISA so the loop gets vectorized at the widest available width.
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void grid_run(const struct grid_cell* cell, double v, double w, double ox, double dx, int first,
+                     double frequency, double cx, double amplitude, double* total, int start, int end) {
+    for (int i = start; i < end; i++) {
+        double x = (ox + (first + i) * dx) * frequency - cx;
+        double x1 = x - 1.;
+        double u = fade(x);
+
+        double n = lerp(w, lerp(v, lerp(u, cell->c[0] + cell->k[0] * x , cell->c[1] + cell->k[1] * x1),
+                                   lerp(u, cell->c[2] + cell->k[2] * x , cell->c[3] + cell->k[3] * x1)),
+                           lerp(v, lerp(u, cell->c[4] + cell->k[4] * x , cell->c[5] + cell->k[5] * x1),
+                                   lerp(u, cell->c[6] + cell->k[6] * x , cell->c[7] + cell->k[7] * x1)));
+        total[i] += n * amplitude;
+    }
+}
+
+// Below this many samples per lattice cell the batched kernel is cheaper
+// than walking cells
+#define GRID_MIN_RUN 16.0
+
+// Adds one octave of columns first to first + width - 1 of a grid row,
+// scaled by amplitude, onto total. Coordinates come from the column in the
+// whole row, so layer fills sample exactly what grid fills do.
+static void grid_row_octave(const uint8_t* p, double ox, double dx, int first, double sy, double sz, int width,
+                            double frequency, double amplitude, double* total) {
+    if (fabs(dx * frequency) * GRID_MIN_RUN > 1.0) {
+        double sx[OCTAVE_CHUNK];
+        double syv[OCTAVE_CHUNK];
+        double szv[OCTAVE_CHUNK];
+        double value[OCTAVE_CHUNK];
+
+        for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+            int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+            for (int i = 0; i < count; i++) {
+                sx[i] = (ox + (first + start + i) * dx) * frequency;
+                syv[i] = sy;
+                szv[i] = sz;
+            }
+
+            perm_at_n(p, sx, syv, szv, value, (size_t) count);
+
+            for (int i = 0; i < count; i++) {
+                total[start + i] += value[i] * amplitude;
+            }
+        }
+        return;
+    }
+
+    int Y = (int)floor(sy) & 255;
+    int Z = (int)floor(sz) & 255;
+    double y = sy - floor(sy);
+    double z = sz - floor(sz);
+    double v = fade(y);
+    double w = fade(z);
+
+    struct grid_cell cell;
+
+    int i = 0;
+    while (i < width) {
+        double cx = floor((ox + (first + i) * dx) * frequency);
+        grid_cell_setup(&cell, p, (int)cx & 255, Y, Z, y, z);
+
+        // Extend the run over every following sample in the same cell
+        int end = i + 1;
+        while (end < width) {
+            double sx = (ox + (first + end) * dx) * frequency;
+            if (sx < cx || sx >= cx + 1.0) {
+                break;
+            }
+            end++;
+        }
+
+        grid_run(&cell, v, w, ox, dx, first, frequency, cx, amplitude, total, i, end);
+        i = end;
+    }
+}
+
+void iperlin_fill_grid(double ox, double oy, double oz, double dx, double dy, int width, int height,
+                       int octaves, double persistence, double bfreq, double bamp, double* out) {
+    iperlin_ctx_fill_grid(&noyc_default_context, ox, oy, oz, dx, dy, width, height,
+                          octaves, persistence, bfreq, bamp, out);
+}
+
+void iperlin_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                           int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                           double* out) {
+    for (int j = 0; j < height; j++) {
+        double* total = out + (size_t) j * width;
+        double y = oy + j * dy;
+
+        for (int i = 0; i < width; i++) {
+            total[i] = 0.0;
+        }
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (int o = 0; o < octaves; o++) {
+            grid_row_octave(noyc_context_perm(context, o), ox, dx, 0, y * frequency, oz * frequency, width,
+                            frequency, amplitude, total);
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (int i = 0; i < width; i++) {
+            total[i] /= max_value;
+        }
+    }
+}
+
+void iperlin_fill_layers(double ox, double oy, double oz, double dx, double dy, int width, int height,
+                         int octaves, double bfreq, float* layers, size_t layer_stride) {
+    iperlin_ctx_fill_layers(&noyc_default_context, ox, oy, oz, dx, dy, width, height,
+                            octaves, bfreq, layers, layer_stride);
+}
+
+void iperlin_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                             int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride) {
+    double total[OCTAVE_CHUNK];
+
+    for (int j = 0; j < height; j++) {
+        double y = oy + j * dy;
+        double frequency = bfreq;
+
+        for (int o = 0; o < octaves; o++) {
+            float* layer = layers + o * layer_stride + (size_t) j * width;
+
+            for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+                int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+                for (int i = 0; i < count; i++) {
+                    total[i] = 0.0;
+                }
+
+                grid_row_octave(noyc_context_perm(context, o), ox, dx, start, y * frequency, oz * frequency,
+                                count, frequency, 1.0, total);
+
+                for (int i = 0; i < count; i++) {
+                    layer[start + i] = (float) total[i];
+                }
+            }
+
+            frequency *= 2;
+        }
+    }
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void iperlin_combine_layers(const float* layers, size_t layer_stride, size_t n,
+                            int octaves, double persistence, double bamp, double* out) {
+    double amplitude = bamp;
+    double max_value = 0.0;
+    for (int o = 0; o < octaves; o++) {
+        max_value += amplitude;
+        amplitude *= persistence;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        out[i] = 0.0;
+    }
+
+    // One streaming pass per octave keeps the inner loop a plain multiply-add
+    amplitude = bamp;
+    for (int o = 0; o < octaves; o++) {
+        const float* layer = layers + o * layer_stride;
+        double weight = amplitude / max_value;
+
+        for (size_t i = 0; i < n; i++) {
+            out[i] += layer[i] * weight;
+        }
+
+        amplitude *= persistence;
+    }
+}
+
+/*
+** Derivatives
+**
+** The value is interpolated from the corners exactly like iperlin_at, and
+** every lerp carries the partial derivatives along with it. Corner
+** gradients are constant vectors, so a lerp's derivative is the lerp of its
+** ends' derivatives, plus the difference of its ends times the derivative
+** of the fade curve along its own axis.
+*/
+
+static inline double dfade(double t) {
+    return 30.0 * t * t * (t * (t - 2.0) + 1.0);
+}
+
+// Gradient vector of grad(hash, ...), components are -1, 0 or 1
+static inline void grad_vector(int hash, double* gx, double* gy, double* gz) {
+    int h = hash & 15;
+    double su = (h&1) == 0 ? 1.0 : -1.0;
+    double sv = (h&2) == 0 ? 1.0 : -1.0;
+    int v_is_x = h >= 4 && (h&13) == 12;
+    *gx = (h<8 ? su : 0.0) + (v_is_x ? sv : 0.0);
+    *gy = (h<8 ? 0.0 : su) + (h<4 ? sv : 0.0);
+    *gz = h>=4 && !v_is_x ? sv : 0.0;
+}
+
+// A value and its partial derivatives
+struct noise_d {
+    double v;
+    double dx;
+    double dy;
+    double dz;
+};
+
+static inline struct noise_d corner_d(int hash, double x, double y, double z) {
+    struct noise_d c = { .v = grad(hash, x, y, z) };
+    grad_vector(hash, &c.dx, &c.dy, &c.dz);
+    return c;
+}
 
+// lerp of a value and its derivatives, where t depends on coordinate axis
+// only
+__attribute__((always_inline))
+static inline struct noise_d lerp_d(double t, double dt, int axis, struct noise_d a, struct noise_d b) {
+    struct noise_d r = {
+        .v = lerp(t, a.v, b.v),
+        .dx = lerp(t, a.dx, b.dx),
+        .dy = lerp(t, a.dy, b.dy),
+        .dz = lerp(t, a.dz, b.dz),
+    };
+    double slope = dt * (b.v - a.v);
+    if (axis == 0) {
+        r.dx += slope;
+    } else if (axis == 1) {
+        r.dy += slope;
+    } else {
+        r.dz += slope;
+    }
+    return r;
+}
+
+__attribute__((always_inline))
+static inline double iperlin3_d(const uint8_t* p, double x, double y, double z, double* dx, double* dy, double* dz) {
     int X = (int)floor(x) & 255;
     int Y = (int)floor(y) & 255;
     int Z = (int)floor(z) & 255;
@@ -60,32 +447,236 @@ double iperlin_at(double x, double y, double z) {
     double u = fade(x);
     double v = fade(y);
     double w = fade(z);
+    double du = dfade(x);
+    double dv = dfade(y);
+    double dw = dfade(z);
+
+    int A = noyc_perm(p, X) + Y;
+    int AA = noyc_perm(p, A) + Z;
+    int AB = noyc_perm(p, A+1) + Z;
+    int B = noyc_perm(p, X+1) + Y;
+    int BA = noyc_perm(p, B) + Z;
+    int BB = noyc_perm(p, B+1) + Z;
 
-    int A = p[X] + Y;
-    int AA = p[A] + Z;
-    int AB = p[A+1] + Z;
-    int B = p[X+1] + Y;
-    int BA = p[B] + Z;
-    int BB = p[B+1] + Z;
+    // The same lerps as iperlin3, in the same order
+    struct noise_d n = lerp_d(w, dw, 2,
+        lerp_d(v, dv, 1, lerp_d(u, du, 0, corner_d(noyc_perm(p, AA), x   , y   , z   ),
+                                          corner_d(noyc_perm(p, BA), x-1., y   , z   )),
+                         lerp_d(u, du, 0, corner_d(noyc_perm(p, AB), x   , y-1., z   ),
+                                          corner_d(noyc_perm(p, BB), x-1., y-1., z   ))),
+        lerp_d(v, dv, 1, lerp_d(u, du, 0, corner_d(noyc_perm(p, AA+1), x   , y   , z-1.),
+                                          corner_d(noyc_perm(p, BA+1), x-1., y   , z-1.)),
+                         lerp_d(u, du, 0, corner_d(noyc_perm(p, AB+1), x   , y-1., z-1.),
+                                          corner_d(noyc_perm(p, BB+1), x-1., y-1., z-1.))));
 
-    return lerp(w, lerp(v, lerp(u, grad((double) p[AA  ], x   , y   , z   ),
-                                   grad((double) p[BA  ], x-1., y   , z   )),
-                           lerp(u, grad((double) p[AB  ], x   , y-1., z   ),
-                                   grad((double) p[BB  ], x-1., y-1., z   ))),
-                   lerp(v, lerp(u, grad((double) p[AA+1], x   , y   , z-1.),
-                                   grad((double) p[BA+1], x-1., y   , z-1. )),
-                           lerp(u, grad((double) p[AB+1], x   , y-1., z-1.),
-                                   grad((double) p[BB+1], x-1., y-1., z-1.))));
+    *dx = n.dx;
+    *dy = n.dy;
+    *dz = n.dz;
+    return n.v;
 }
 
-double octave_iperlin_at(double x, double y, double z, int octaves, double persistence, double bfreq, double bamp) {
+double iperlin_at_d(double x, double y, double z, double* dx, double* dy, double* dz) {
+    return iperlin_ctx_at_d(&noyc_default_context, x, y, z, dx, dy, dz);
+}
+
+double iperlin_ctx_at_d(const struct noyc_context* context, double x, double y, double z,
+                        double* dx, double* dy, double* dz) {
+    return iperlin3_d(noyc_context_perm(context, 0), x, y, z, dx, dy, dz);
+}
+
+double octave_iperlin_at_d(double x, double y, double z, int octaves, double persistence, double bfreq, double bamp,
+                           double* dx, double* dy, double* dz) {
+    return octave_iperlin_ctx_at_d(&noyc_default_context, x, y, z, octaves, persistence, bfreq, bamp, dx, dy, dz);
+}
+
+// Octave o is noise of the coordinates times its frequency, so its
+// derivatives are scaled by the frequency as well
+double octave_iperlin_ctx_at_d(const struct noyc_context* context, double x, double y, double z, int octaves,
+                               double persistence, double bfreq, double bamp, double* dx, double* dy, double* dz) {
+    double total = 0.0;
+    double tx = 0.0;
+    double ty = 0.0;
+    double tz = 0.0;
+    double frequency = bfreq;
+    double amplitude = bamp;
+    double max_value = 0.0;
+
+    for (int i = 0; i < octaves; i++) {
+        double gx, gy, gz;
+        total += iperlin3_d(noyc_context_perm(context, i), x * frequency, y * frequency, z * frequency,
+                            &gx, &gy, &gz) * amplitude;
+        tx += gx * (amplitude * frequency);
+        ty += gy * (amplitude * frequency);
+        tz += gz * (amplitude * frequency);
+        max_value += amplitude;
+
+        amplitude *= persistence;
+        frequency *= 2;
+    }
+
+    *dx = tx / max_value;
+    *dy = ty / max_value;
+    *dz = tz / max_value;
+    return total / max_value;
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void perm_at_d_loop(const uint8_t* p, const double* x, const double* y, const double* z,
+                           double* restrict out, double* restrict dx, double* restrict dy, double* restrict dz,
+                           size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = iperlin3_d(p, x[i], y[i], z[i], &dx[i], &dy[i], &dz[i]);
+    }
+}
+
+static void perm_at_d_n(const uint8_t* p, const double* x, const double* y, const double* z,
+                        double* out, double* dx, double* dy, double* dz, size_t n) {
+    size_t done = 0;
+
+    iperlin_d_kernel kernel = iperlin_d_select_kernel();
+    if (kernel) {
+        done = kernel(p, x, y, z, out, dx, dy, dz, n);
+    }
+    perm_at_d_loop(p, x + done, y + done, z + done, out + done, dx + done, dy + done, dz + done, n - done);
+}
+
+void iperlin_at_d_n(const double* x, const double* y, const double* z, double* out,
+                    double* dx, double* dy, double* dz, size_t n) {
+    perm_at_d_n(noyc_context_perm(&noyc_default_context, 0), x, y, z, out, dx, dy, dz, n);
+}
+
+void iperlin_ctx_at_d_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                        double* out, double* dx, double* dy, double* dz, size_t n) {
+    perm_at_d_n(noyc_context_perm(context, 0), x, y, z, out, dx, dy, dz, n);
+}
+
+void octave_iperlin_at_d_n(const double* x, const double* y, const double* z, double* out,
+                           double* dx, double* dy, double* dz, size_t n,
+                           int octaves, double persistence, double bfreq, double bamp) {
+    octave_iperlin_ctx_at_d_n(&noyc_default_context, x, y, z, out, dx, dy, dz, n, octaves, persistence, bfreq, bamp);
+}
+
+void octave_iperlin_ctx_at_d_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                               double* out, double* dx, double* dy, double* dz, size_t n,
+                               int octaves, double persistence, double bfreq, double bamp) {
+    double sx[OCTAVE_CHUNK];
+    double sy[OCTAVE_CHUNK];
+    double sz[OCTAVE_CHUNK];
+    double value[OCTAVE_CHUNK];
+    double gx[OCTAVE_CHUNK];
+    double gy[OCTAVE_CHUNK];
+    double gz[OCTAVE_CHUNK];
+    double total[OCTAVE_CHUNK];
+    double tx[OCTAVE_CHUNK];
+    double ty[OCTAVE_CHUNK];
+    double tz[OCTAVE_CHUNK];
+
+    for (size_t start = 0; start < n; start += OCTAVE_CHUNK) {
+        size_t count = n - start < OCTAVE_CHUNK ? n - start : OCTAVE_CHUNK;
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (size_t i = 0; i < count; i++) {
+            total[i] = 0.0;
+            tx[i] = 0.0;
+            ty[i] = 0.0;
+            tz[i] = 0.0;
+        }
+
+        for (int o = 0; o < octaves; o++) {
+            for (size_t i = 0; i < count; i++) {
+                sx[i] = x[start + i] * frequency;
+                sy[i] = y[start + i] * frequency;
+                sz[i] = z[start + i] * frequency;
+            }
+
+            perm_at_d_n(noyc_context_perm(context, o), sx, sy, sz, value, gx, gy, gz, count);
+
+            double scale = amplitude * frequency;
+            for (size_t i = 0; i < count; i++) {
+                total[i] += value[i] * amplitude;
+                tx[i] += gx[i] * scale;
+                ty[i] += gy[i] * scale;
+                tz[i] += gz[i] * scale;
+            }
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            out[start + i] = total[i] / max_value;
+            dx[start + i] = tx[i] / max_value;
+            dy[start + i] = ty[i] / max_value;
+            dz[start + i] = tz[i] / max_value;
+        }
+    }
+}
+
+/*
+** 2D noise
+**
+** The gradients are the 3D set projected onto the z == 0 plane, so iperlin2_at(x, y)
+** gives the same values as iperlin_at(x, y, 0.0) from four corners instead of eight.
+*/
+
+double grad2(int hash, double x, double y) {
+    int h = hash & 15;
+    if (h < 4) {
+        return ((h&1) == 0 ? x : -x) + ((h&2) == 0 ? y : -y);
+    }
+    if (h < 8) {
+        return (h&1) == 0 ? x : -x;
+    }
+    if (h == 12 || h == 14) {
+        return ((h&1) == 0 ? y : -y) + ((h&2) == 0 ? x : -x);
+    }
+    return (h&1) == 0 ? y : -y;
+}
+
+static inline double iperlin2(const uint8_t* p, double x, double y) {
+    int X = (int)floor(x) & 255;
+    int Y = (int)floor(y) & 255;
+
+    x -= floor(x);
+    y -= floor(y);
+
+    double u = fade(x);
+    double v = fade(y);
+
+    int A = noyc_perm(p, X) + Y;
+    int B = noyc_perm(p, X+1) + Y;
+
+    return lerp(v, lerp(u, grad2(noyc_perm(p, noyc_perm(p, A)), x   , y   ),
+                           grad2(noyc_perm(p, noyc_perm(p, B)), x-1., y   )),
+                   lerp(u, grad2(noyc_perm(p, noyc_perm(p, A+1)), x   , y-1.),
+                           grad2(noyc_perm(p, noyc_perm(p, B+1)), x-1., y-1.)));
+}
+
+double iperlin2_at(double x, double y) {
+    return iperlin2_ctx_at(&noyc_default_context, x, y);
+}
+
+double iperlin2_ctx_at(const struct noyc_context* context, double x, double y) {
+    return iperlin2(noyc_context_perm(context, 0), x, y);
+}
+
+double octave_iperlin2_at(double x, double y, int octaves, double persistence, double bfreq, double bamp) {
+    return octave_iperlin2_ctx_at(&noyc_default_context, x, y, octaves, persistence, bfreq, bamp);
+}
+
+double octave_iperlin2_ctx_at(const struct noyc_context* context, double x, double y, int octaves, double persistence,
+                              double bfreq, double bamp) {
     double total = 0.0;
     double frequency = bfreq;
     double amplitude = bamp;
     double max_value = 0.0;
 
     for (int i = 0; i < octaves; i++) {
-        total += iperlin_at(x * frequency, y * frequency, z * frequency) * amplitude;
+        total += iperlin2(noyc_context_perm(context, i), x * frequency, y * frequency) * amplitude;
         max_value += amplitude;
 
         amplitude *= persistence;
@@ -94,3 +685,1044 @@ double octave_iperlin_at(double x, double y, double z, int octaves, double persi
 
     return total / max_value;
 }
+
+static void perm2_at_n(const uint8_t* p, const double* x, const double* y, double* out, size_t n) {
+    size_t done = 0;
+
+    iperlin2_kernel kernel = iperlin2_select_kernel();
+    if (kernel) {
+        done = kernel(p, x, y, out, n);
+    }
+
+    for (size_t i = done; i < n; i++) {
+        out[i] = iperlin2(p, x[i], y[i]);
+    }
+}
+
+void iperlin2_at_n(const double* x, const double* y, double* out, size_t n) {
+    perm2_at_n(noyc_context_perm(&noyc_default_context, 0), x, y, out, n);
+}
+
+void iperlin2_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, double* out, size_t n) {
+    perm2_at_n(noyc_context_perm(context, 0), x, y, out, n);
+}
+
+void octave_iperlin2_at_n(const double* x, const double* y, double* out, size_t n,
+                          int octaves, double persistence, double bfreq, double bamp) {
+    octave_iperlin2_ctx_at_n(&noyc_default_context, x, y, out, n, octaves, persistence, bfreq, bamp);
+}
+
+void octave_iperlin2_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, double* out,
+                              size_t n, int octaves, double persistence, double bfreq, double bamp) {
+    double sx[OCTAVE_CHUNK];
+    double sy[OCTAVE_CHUNK];
+    double value[OCTAVE_CHUNK];
+    double total[OCTAVE_CHUNK];
+
+    for (size_t start = 0; start < n; start += OCTAVE_CHUNK) {
+        size_t count = n - start < OCTAVE_CHUNK ? n - start : OCTAVE_CHUNK;
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (size_t i = 0; i < count; i++) {
+            total[i] = 0.0;
+        }
+
+        for (int o = 0; o < octaves; o++) {
+            for (size_t i = 0; i < count; i++) {
+                sx[i] = x[start + i] * frequency;
+                sy[i] = y[start + i] * frequency;
+            }
+
+            perm2_at_n(noyc_context_perm(context, o), sx, sy, value, count);
+
+            for (size_t i = 0; i < count; i++) {
+                total[i] += value[i] * amplitude;
+            }
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            out[start + i] = total[i] / max_value;
+        }
+    }
+}
+
+// 2D gradient of a corner with y fixed, as a constant plus a multiple of x
+static void grid2_corner(int hash, double y, double* k, double* c) {
+    int h = hash & 15;
+    if (h < 4) {
+        *k = (h&1) == 0 ? 1.0 : -1.0;
+        *c = (h&2) == 0 ? y : -y;
+    } else if (h < 8) {
+        *k = (h&1) == 0 ? 1.0 : -1.0;
+        *c = 0.0;
+    } else if (h == 12 || h == 14) {
+        *k = (h&2) == 0 ? 1.0 : -1.0;
+        *c = (h&1) == 0 ? y : -y;
+    } else {
+        *k = 0.0;
+        *c = (h&1) == 0 ? y : -y;
+    }
+}
+
+static void grid2_cell_setup(struct grid_cell* cell, const uint8_t* p, int X, int Y, double y) {
+    int A = noyc_perm(p, X) + Y;
+    int B = noyc_perm(p, X+1) + Y;
+
+    grid2_corner(noyc_perm(p, noyc_perm(p, A)), y   , &cell->k[0], &cell->c[0]);
+    grid2_corner(noyc_perm(p, noyc_perm(p, B)), y   , &cell->k[1], &cell->c[1]);
+    grid2_corner(noyc_perm(p, noyc_perm(p, A+1)), y-1., &cell->k[2], &cell->c[2]);
+    grid2_corner(noyc_perm(p, noyc_perm(p, B+1)), y-1., &cell->k[3], &cell->c[3]);
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void grid2_run(const struct grid_cell* cell, double v, double ox, double dx, int first,
+                      double frequency, double cx, double amplitude, double* total, int start, int end) {
+    for (int i = start; i < end; i++) {
+        double x = (ox + (first + i) * dx) * frequency - cx;
+        double x1 = x - 1.;
+        double u = fade(x);
+
+        double n = lerp(v, lerp(u, cell->c[0] + cell->k[0] * x , cell->c[1] + cell->k[1] * x1),
+                           lerp(u, cell->c[2] + cell->k[2] * x , cell->c[3] + cell->k[3] * x1));
+        total[i] += n * amplitude;
+    }
+}
+
+static void grid2_row_octave(const uint8_t* p, double ox, double dx, int first, double sy, int width,
+                             double frequency, double amplitude, double* total) {
+    if (fabs(dx * frequency) * GRID_MIN_RUN > 1.0) {
+        double sx[OCTAVE_CHUNK];
+        double syv[OCTAVE_CHUNK];
+        double value[OCTAVE_CHUNK];
+
+        for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+            int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+            for (int i = 0; i < count; i++) {
+                sx[i] = (ox + (first + start + i) * dx) * frequency;
+                syv[i] = sy;
+            }
+
+            perm2_at_n(p, sx, syv, value, (size_t) count);
+
+            for (int i = 0; i < count; i++) {
+                total[start + i] += value[i] * amplitude;
+            }
+        }
+        return;
+    }
+
+    int Y = (int)floor(sy) & 255;
+    double y = sy - floor(sy);
+    double v = fade(y);
+
+    struct grid_cell cell;
+
+    int i = 0;
+    while (i < width) {
+        double cx = floor((ox + (first + i) * dx) * frequency);
+        grid2_cell_setup(&cell, p, (int)cx & 255, Y, y);
+
+        int end = i + 1;
+        while (end < width) {
+            double sx = (ox + (first + end) * dx) * frequency;
+            if (sx < cx || sx >= cx + 1.0) {
+                break;
+            }
+            end++;
+        }
+
+        grid2_run(&cell, v, ox, dx, first, frequency, cx, amplitude, total, i, end);
+        i = end;
+    }
+}
+
+void iperlin2_fill_grid(double ox, double oy, double dx, double dy, int width, int height,
+                        int octaves, double persistence, double bfreq, double bamp, double* out) {
+    iperlin2_ctx_fill_grid(&noyc_default_context, ox, oy, dx, dy, width, height,
+                           octaves, persistence, bfreq, bamp, out);
+}
+
+void iperlin2_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                            int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                            double* out) {
+    for (int j = 0; j < height; j++) {
+        double* total = out + (size_t) j * width;
+        double y = oy + j * dy;
+
+        for (int i = 0; i < width; i++) {
+            total[i] = 0.0;
+        }
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (int o = 0; o < octaves; o++) {
+            grid2_row_octave(noyc_context_perm(context, o), ox, dx, 0, y * frequency, width,
+                             frequency, amplitude, total);
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (int i = 0; i < width; i++) {
+            total[i] /= max_value;
+        }
+    }
+}
+
+void iperlin2_fill_layers(double ox, double oy, double dx, double dy, int width, int height,
+                          int octaves, double bfreq, float* layers, size_t layer_stride) {
+    iperlin2_ctx_fill_layers(&noyc_default_context, ox, oy, dx, dy, width, height,
+                             octaves, bfreq, layers, layer_stride);
+}
+
+void iperlin2_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                              int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride) {
+    double total[OCTAVE_CHUNK];
+
+    for (int j = 0; j < height; j++) {
+        double y = oy + j * dy;
+        double frequency = bfreq;
+
+        for (int o = 0; o < octaves; o++) {
+            float* layer = layers + o * layer_stride + (size_t) j * width;
+
+            for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+                int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+                for (int i = 0; i < count; i++) {
+                    total[i] = 0.0;
+                }
+
+                grid2_row_octave(noyc_context_perm(context, o), ox, dx, start, y * frequency, count,
+                                 frequency, 1.0, total);
+
+                for (int i = 0; i < count; i++) {
+                    layer[start + i] = (float) total[i];
+                }
+            }
+
+            frequency *= 2;
+        }
+    }
+}
+
+/*
+** 4D noise
+**
+** Corners are hashed like the 3D ones with a fourth lookup, onto the 32
+** gradients that have one zero and three unit components. There are no
+** hand written kernels, the batched loop inlines the scalar function into
+** each ISA clone.
+*/
+
+static inline double grad4(int hash, double x, double y, double z, double w) {
+    int h = hash & 31;
+    double a = h<24 ? x : y;
+    double b = h<16 ? y : z;
+    double c = h<8 ? z : w;
+    return ((h&1) == 0 ? a : -a) + ((h&2) == 0 ? b : -b) + ((h&4) == 0 ? c : -c);
+}
+
+__attribute__((always_inline))
+static inline double iperlin4(const uint8_t* p, double x, double y, double z, double w) {
+    double fx = floor(x);
+    double fy = floor(y);
+    double fz = floor(z);
+    double fw = floor(w);
+
+    int X = (int)fx & 255;
+    int Y = (int)fy & 255;
+    int Z = (int)fz & 255;
+    int W = (int)fw & 255;
+
+    x -= fx;
+    y -= fy;
+    z -= fz;
+    w -= fw;
+
+    double u = fade(x);
+    double v = fade(y);
+    double s = fade(z);
+    double t = fade(w);
+
+    // Letters pick the x, y and z side of the corner, the w side is the
+    // last lookup plus 0 or 1
+    int A = noyc_perm(p, X) + Y;
+    int B = noyc_perm(p, X+1) + Y;
+    int AA = noyc_perm(p, A) + Z;
+    int AB = noyc_perm(p, A+1) + Z;
+    int BA = noyc_perm(p, B) + Z;
+    int BB = noyc_perm(p, B+1) + Z;
+    int AAA = noyc_perm(p, AA) + W;
+    int AAB = noyc_perm(p, AA+1) + W;
+    int ABA = noyc_perm(p, AB) + W;
+    int ABB = noyc_perm(p, AB+1) + W;
+    int BAA = noyc_perm(p, BA) + W;
+    int BAB = noyc_perm(p, BA+1) + W;
+    int BBA = noyc_perm(p, BB) + W;
+    int BBB = noyc_perm(p, BB+1) + W;
+
+    // Peaks reach about 1.23, scaled back into [-1, 1]
+    double w1 = w - 1.;
+    return 0.8 * lerp(t, lerp(s, lerp(v, lerp(u, grad4(noyc_perm(p, AAA), x   , y   , z   , w),
+                                                 grad4(noyc_perm(p, BAA), x-1., y   , z   , w)),
+                                         lerp(u, grad4(noyc_perm(p, ABA), x   , y-1., z   , w),
+                                                 grad4(noyc_perm(p, BBA), x-1., y-1., z   , w))),
+                                 lerp(v, lerp(u, grad4(noyc_perm(p, AAB), x   , y   , z-1., w),
+                                                 grad4(noyc_perm(p, BAB), x-1., y   , z-1., w)),
+                                         lerp(u, grad4(noyc_perm(p, ABB), x   , y-1., z-1., w),
+                                                 grad4(noyc_perm(p, BBB), x-1., y-1., z-1., w)))),
+                         lerp(s, lerp(v, lerp(u, grad4(noyc_perm(p, AAA+1), x   , y   , z   , w1),
+                                                 grad4(noyc_perm(p, BAA+1), x-1., y   , z   , w1)),
+                                         lerp(u, grad4(noyc_perm(p, ABA+1), x   , y-1., z   , w1),
+                                                 grad4(noyc_perm(p, BBA+1), x-1., y-1., z   , w1))),
+                                 lerp(v, lerp(u, grad4(noyc_perm(p, AAB+1), x   , y   , z-1., w1),
+                                                 grad4(noyc_perm(p, BAB+1), x-1., y   , z-1., w1)),
+                                         lerp(u, grad4(noyc_perm(p, ABB+1), x   , y-1., z-1., w1),
+                                                 grad4(noyc_perm(p, BBB+1), x-1., y-1., z-1., w1)))));
+}
+
+double iperlin4_at(double x, double y, double z, double w) {
+    return iperlin4_ctx_at(&noyc_default_context, x, y, z, w);
+}
+
+double iperlin4_ctx_at(const struct noyc_context* context, double x, double y, double z, double w) {
+    return iperlin4(noyc_context_perm(context, 0), x, y, z, w);
+}
+
+double octave_iperlin4_at(double x, double y, double z, double w, int octaves, double persistence,
+                          double bfreq, double bamp) {
+    return octave_iperlin4_ctx_at(&noyc_default_context, x, y, z, w, octaves, persistence, bfreq, bamp);
+}
+
+double octave_iperlin4_ctx_at(const struct noyc_context* context, double x, double y, double z, double w,
+                              int octaves, double persistence, double bfreq, double bamp) {
+    double total = 0.0;
+    double frequency = bfreq;
+    double amplitude = bamp;
+    double max_value = 0.0;
+
+    for (int i = 0; i < octaves; i++) {
+        total += iperlin4(noyc_context_perm(context, i), x * frequency, y * frequency, z * frequency, w * frequency)
+            * amplitude;
+        max_value += amplitude;
+
+        amplitude *= persistence;
+        frequency *= 2;
+    }
+
+    return total / max_value;
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void perm4_at_n(const uint8_t* p, const double* x, const double* y, const double* z, const double* w,
+                       double* restrict out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = iperlin4(p, x[i], y[i], z[i], w[i]);
+    }
+}
+
+void iperlin4_at_n(const double* x, const double* y, const double* z, const double* w, double* out, size_t n) {
+    perm4_at_n(noyc_context_perm(&noyc_default_context, 0), x, y, z, w, out, n);
+}
+
+void iperlin4_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                       const double* w, double* out, size_t n) {
+    perm4_at_n(noyc_context_perm(context, 0), x, y, z, w, out, n);
+}
+
+static void grid4_row_octave(const uint8_t* p, double ox, double dx, int first, double sy, double sz, double sw,
+                             int width, double frequency, double amplitude, double* total) {
+    double sx[OCTAVE_CHUNK];
+    double syv[OCTAVE_CHUNK];
+    double szv[OCTAVE_CHUNK];
+    double swv[OCTAVE_CHUNK];
+    double value[OCTAVE_CHUNK];
+
+    for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+        int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+        for (int i = 0; i < count; i++) {
+            sx[i] = (ox + (first + start + i) * dx) * frequency;
+            syv[i] = sy;
+            szv[i] = sz;
+            swv[i] = sw;
+        }
+
+        perm4_at_n(p, sx, syv, szv, swv, value, (size_t) count);
+
+        for (int i = 0; i < count; i++) {
+            total[start + i] += value[i] * amplitude;
+        }
+    }
+}
+
+void iperlin4_fill_grid(double ox, double oy, double oz, double ow, double dx, double dy, int width, int height,
+                        int octaves, double persistence, double bfreq, double bamp, double* out) {
+    iperlin4_ctx_fill_grid(&noyc_default_context, ox, oy, oz, ow, dx, dy, width, height,
+                           octaves, persistence, bfreq, bamp, out);
+}
+
+void iperlin4_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                            double dx, double dy, int width, int height, int octaves, double persistence,
+                            double bfreq, double bamp, double* out) {
+    for (int j = 0; j < height; j++) {
+        double* total = out + (size_t) j * width;
+        double y = oy + j * dy;
+
+        for (int i = 0; i < width; i++) {
+            total[i] = 0.0;
+        }
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (int o = 0; o < octaves; o++) {
+            grid4_row_octave(noyc_context_perm(context, o), ox, dx, 0, y * frequency, oz * frequency, ow * frequency,
+                             width, frequency, amplitude, total);
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (int i = 0; i < width; i++) {
+            total[i] /= max_value;
+        }
+    }
+}
+
+void iperlin4_fill_layers(double ox, double oy, double oz, double ow, double dx, double dy, int width, int height,
+                          int octaves, double bfreq, float* layers, size_t layer_stride) {
+    iperlin4_ctx_fill_layers(&noyc_default_context, ox, oy, oz, ow, dx, dy, width, height,
+                             octaves, bfreq, layers, layer_stride);
+}
+
+void iperlin4_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                              double dx, double dy, int width, int height, int octaves, double bfreq,
+                              float* layers, size_t layer_stride) {
+    double total[OCTAVE_CHUNK];
+
+    for (int j = 0; j < height; j++) {
+        double y = oy + j * dy;
+        double frequency = bfreq;
+
+        for (int o = 0; o < octaves; o++) {
+            float* layer = layers + o * layer_stride + (size_t) j * width;
+
+            for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+                int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+                for (int i = 0; i < count; i++) {
+                    total[i] = 0.0;
+                }
+
+                grid4_row_octave(noyc_context_perm(context, o), ox, dx, start, y * frequency, oz * frequency,
+                                 ow * frequency, count, frequency, 1.0, total);
+
+                for (int i = 0; i < count; i++) {
+                    layer[start + i] = (float) total[i];
+                }
+            }
+
+            frequency *= 2;
+        }
+    }
+}
+
+/*
+** Hashed lattice
+**
+** The same gradient noise with its corners hashed by integer arithmetic on
+** a seed instead of permutation table lookups. The lattice only repeats
+** after 2^32 units, and with nothing loaded per corner the batched loops
+** vectorize without gathers. Coordinates have to stay within the int range.
+**
+** A corner hash xors one term per axis, the lattice coordinate times an odd
+** multiplier, and the seed, then hash_mix spreads the bits.
+**
+** Like iperlin2_at, the 2D functions match the 3D ones at z == 0.
+*/
+
+// Per axis multipliers of the lattice coordinates, odd and unrelated
+#define HASH_X 0x8da6b343u
+#define HASH_Y 0xd8163841u
+#define HASH_Z 0xcb1ab31fu
+#define HASH_W 0x9e3779b1u
+
+// Spreads every input bit over the low bits the gradients are picked from
+static inline int hash_mix(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (int) (h & 0x7fffffff);
+}
+
+// Axis term of a corner hash, corners xor one term per axis
+static inline uint32_t hash_term(double f, uint32_t multiplier) {
+    return (uint32_t) (int) f * multiplier;
+}
+
+// grad with h == 12 || h == 14 spelled (h & 13) == 12, which keeps the
+// batched loops free of branches
+static inline double hash_grad(int hash, double x, double y, double z) {
+    int h = hash & 15;
+    double u = h<8 ? x : y;
+    double v = h<4 ? y : (h&13) == 12 ? x : z;
+    return ((h&1) == 0 ? u : -u) + ((h&2) == 0 ? v : -v);
+}
+
+__attribute__((always_inline))
+static inline double iperlin_hash(uint32_t seed, double x, double y, double z) {
+    double fx = floor(x);
+    double fy = floor(y);
+    double fz = floor(z);
+
+    uint32_t x0 = hash_term(fx, HASH_X);
+    uint32_t y0 = hash_term(fy, HASH_Y) ^ seed;
+    uint32_t z0 = hash_term(fz, HASH_Z);
+    uint32_t x1 = x0 + HASH_X;
+    uint32_t y1 = (hash_term(fy, HASH_Y) + HASH_Y) ^ seed;
+    uint32_t z1 = z0 + HASH_Z;
+
+    x -= fx;
+    y -= fy;
+    z -= fz;
+
+    double u = fade(x);
+    double v = fade(y);
+    double w = fade(z);
+
+    return lerp(w, lerp(v, lerp(u, hash_grad(hash_mix(x0 ^ y0 ^ z0), x   , y   , z   ),
+                                   hash_grad(hash_mix(x1 ^ y0 ^ z0), x-1., y   , z   )),
+                           lerp(u, hash_grad(hash_mix(x0 ^ y1 ^ z0), x   , y-1., z   ),
+                                   hash_grad(hash_mix(x1 ^ y1 ^ z0), x-1., y-1., z   ))),
+                   lerp(v, lerp(u, hash_grad(hash_mix(x0 ^ y0 ^ z1), x   , y   , z-1.),
+                                   hash_grad(hash_mix(x1 ^ y0 ^ z1), x-1., y   , z-1.)),
+                           lerp(u, hash_grad(hash_mix(x0 ^ y1 ^ z1), x   , y-1., z-1.),
+                                   hash_grad(hash_mix(x1 ^ y1 ^ z1), x-1., y-1., z-1.))));
+}
+
+double iperlin_hash_at(const struct noyc_context* context, double x, double y, double z) {
+    return iperlin_hash(noyc_context_seed(context, 0), x, y, z);
+}
+
+double octave_iperlin_hash_at(const struct noyc_context* context, double x, double y, double z, int octaves,
+                              double persistence, double bfreq, double bamp) {
+    double total = 0.0;
+    double frequency = bfreq;
+    double amplitude = bamp;
+    double max_value = 0.0;
+
+    for (int i = 0; i < octaves; i++) {
+        total += iperlin_hash(noyc_context_seed(context, i), x * frequency, y * frequency, z * frequency) * amplitude;
+        max_value += amplitude;
+
+        amplitude *= persistence;
+        frequency *= 2;
+    }
+
+    return total / max_value;
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void hash_at_n(uint32_t seed, const double* x, const double* y, const double* z, double* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = iperlin_hash(seed, x[i], y[i], z[i]);
+    }
+}
+
+void iperlin_hash_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                       double* out, size_t n) {
+    hash_at_n(noyc_context_seed(context, 0), x, y, z, out, n);
+}
+
+static void hash_cell_setup(struct grid_cell* cell, uint32_t seed, double fx, double fy, double fz,
+                            double y, double z) {
+    uint32_t x0 = hash_term(fx, HASH_X);
+    uint32_t y0 = hash_term(fy, HASH_Y) ^ seed;
+    uint32_t z0 = hash_term(fz, HASH_Z);
+    uint32_t x1 = x0 + HASH_X;
+    uint32_t y1 = (hash_term(fy, HASH_Y) + HASH_Y) ^ seed;
+    uint32_t z1 = z0 + HASH_Z;
+
+    grid_corner(hash_mix(x0 ^ y0 ^ z0), y   , z   , &cell->k[0], &cell->c[0]);
+    grid_corner(hash_mix(x1 ^ y0 ^ z0), y   , z   , &cell->k[1], &cell->c[1]);
+    grid_corner(hash_mix(x0 ^ y1 ^ z0), y-1., z   , &cell->k[2], &cell->c[2]);
+    grid_corner(hash_mix(x1 ^ y1 ^ z0), y-1., z   , &cell->k[3], &cell->c[3]);
+    grid_corner(hash_mix(x0 ^ y0 ^ z1), y   , z-1., &cell->k[4], &cell->c[4]);
+    grid_corner(hash_mix(x1 ^ y0 ^ z1), y   , z-1., &cell->k[5], &cell->c[5]);
+    grid_corner(hash_mix(x0 ^ y1 ^ z1), y-1., z-1., &cell->k[6], &cell->c[6]);
+    grid_corner(hash_mix(x1 ^ y1 ^ z1), y-1., z-1., &cell->k[7], &cell->c[7]);
+}
+
+// grid_row_octave on the hashed lattice
+static void hash_row_octave(uint32_t seed, double ox, double dx, int first, double sy, double sz, int width,
+                            double frequency, double amplitude, double* total) {
+    if (fabs(dx * frequency) * GRID_MIN_RUN > 1.0) {
+        double sx[OCTAVE_CHUNK];
+        double syv[OCTAVE_CHUNK];
+        double szv[OCTAVE_CHUNK];
+        double value[OCTAVE_CHUNK];
+
+        for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+            int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+            for (int i = 0; i < count; i++) {
+                sx[i] = (ox + (first + start + i) * dx) * frequency;
+                syv[i] = sy;
+                szv[i] = sz;
+            }
+
+            hash_at_n(seed, sx, syv, szv, value, (size_t) count);
+
+            for (int i = 0; i < count; i++) {
+                total[start + i] += value[i] * amplitude;
+            }
+        }
+        return;
+    }
+
+    double fy = floor(sy);
+    double fz = floor(sz);
+    double y = sy - fy;
+    double z = sz - fz;
+    double v = fade(y);
+    double w = fade(z);
+
+    struct grid_cell cell;
+
+    int i = 0;
+    while (i < width) {
+        double cx = floor((ox + (first + i) * dx) * frequency);
+        hash_cell_setup(&cell, seed, cx, fy, fz, y, z);
+
+        int end = i + 1;
+        while (end < width) {
+            double sx = (ox + (first + end) * dx) * frequency;
+            if (sx < cx || sx >= cx + 1.0) {
+                break;
+            }
+            end++;
+        }
+
+        grid_run(&cell, v, w, ox, dx, first, frequency, cx, amplitude, total, i, end);
+        i = end;
+    }
+}
+
+void iperlin_hash_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                            int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                            double* out) {
+    for (int j = 0; j < height; j++) {
+        double* total = out + (size_t) j * width;
+        double y = oy + j * dy;
+
+        for (int i = 0; i < width; i++) {
+            total[i] = 0.0;
+        }
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (int o = 0; o < octaves; o++) {
+            hash_row_octave(noyc_context_seed(context, o), ox, dx, 0, y * frequency, oz * frequency, width,
+                            frequency, amplitude, total);
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (int i = 0; i < width; i++) {
+            total[i] /= max_value;
+        }
+    }
+}
+
+void iperlin_hash_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                              int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride) {
+    double total[OCTAVE_CHUNK];
+
+    for (int j = 0; j < height; j++) {
+        double y = oy + j * dy;
+        double frequency = bfreq;
+
+        for (int o = 0; o < octaves; o++) {
+            float* layer = layers + o * layer_stride + (size_t) j * width;
+
+            for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+                int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+                for (int i = 0; i < count; i++) {
+                    total[i] = 0.0;
+                }
+
+                hash_row_octave(noyc_context_seed(context, o), ox, dx, start, y * frequency, oz * frequency,
+                                count, frequency, 1.0, total);
+
+                for (int i = 0; i < count; i++) {
+                    layer[start + i] = (float) total[i];
+                }
+            }
+
+            frequency *= 2;
+        }
+    }
+}
+
+// Hashed 2D noise, the z terms of the 3D corners drop out at z == 0
+__attribute__((always_inline))
+static inline double iperlin2_hash(uint32_t seed, double x, double y) {
+    double fx = floor(x);
+    double fy = floor(y);
+
+    uint32_t x0 = hash_term(fx, HASH_X);
+    uint32_t y0 = hash_term(fy, HASH_Y) ^ seed;
+    uint32_t x1 = x0 + HASH_X;
+    uint32_t y1 = (hash_term(fy, HASH_Y) + HASH_Y) ^ seed;
+
+    x -= fx;
+    y -= fy;
+
+    double u = fade(x);
+    double v = fade(y);
+
+    return lerp(v, lerp(u, hash_grad(hash_mix(x0 ^ y0), x   , y   , 0.0),
+                           hash_grad(hash_mix(x1 ^ y0), x-1., y   , 0.0)),
+                   lerp(u, hash_grad(hash_mix(x0 ^ y1), x   , y-1., 0.0),
+                           hash_grad(hash_mix(x1 ^ y1), x-1., y-1., 0.0)));
+}
+
+double iperlin2_hash_at(const struct noyc_context* context, double x, double y) {
+    return iperlin2_hash(noyc_context_seed(context, 0), x, y);
+}
+
+double octave_iperlin2_hash_at(const struct noyc_context* context, double x, double y, int octaves,
+                               double persistence, double bfreq, double bamp) {
+    double total = 0.0;
+    double frequency = bfreq;
+    double amplitude = bamp;
+    double max_value = 0.0;
+
+    for (int i = 0; i < octaves; i++) {
+        total += iperlin2_hash(noyc_context_seed(context, i), x * frequency, y * frequency) * amplitude;
+        max_value += amplitude;
+
+        amplitude *= persistence;
+        frequency *= 2;
+    }
+
+    return total / max_value;
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void hash2_at_n(uint32_t seed, const double* x, const double* y, double* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = iperlin2_hash(seed, x[i], y[i]);
+    }
+}
+
+void iperlin2_hash_at_n(const struct noyc_context* context, const double* x, const double* y, double* out, size_t n) {
+    hash2_at_n(noyc_context_seed(context, 0), x, y, out, n);
+}
+
+static void hash2_cell_setup(struct grid_cell* cell, uint32_t seed, double fx, double fy, double y) {
+    uint32_t x0 = hash_term(fx, HASH_X);
+    uint32_t y0 = hash_term(fy, HASH_Y) ^ seed;
+    uint32_t x1 = x0 + HASH_X;
+    uint32_t y1 = (hash_term(fy, HASH_Y) + HASH_Y) ^ seed;
+
+    grid2_corner(hash_mix(x0 ^ y0), y   , &cell->k[0], &cell->c[0]);
+    grid2_corner(hash_mix(x1 ^ y0), y   , &cell->k[1], &cell->c[1]);
+    grid2_corner(hash_mix(x0 ^ y1), y-1., &cell->k[2], &cell->c[2]);
+    grid2_corner(hash_mix(x1 ^ y1), y-1., &cell->k[3], &cell->c[3]);
+}
+
+static void hash2_row_octave(uint32_t seed, double ox, double dx, int first, double sy, int width,
+                             double frequency, double amplitude, double* total) {
+    if (fabs(dx * frequency) * GRID_MIN_RUN > 1.0) {
+        double sx[OCTAVE_CHUNK];
+        double syv[OCTAVE_CHUNK];
+        double value[OCTAVE_CHUNK];
+
+        for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+            int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+            for (int i = 0; i < count; i++) {
+                sx[i] = (ox + (first + start + i) * dx) * frequency;
+                syv[i] = sy;
+            }
+
+            hash2_at_n(seed, sx, syv, value, (size_t) count);
+
+            for (int i = 0; i < count; i++) {
+                total[start + i] += value[i] * amplitude;
+            }
+        }
+        return;
+    }
+
+    double fy = floor(sy);
+    double y = sy - fy;
+    double v = fade(y);
+
+    struct grid_cell cell;
+
+    int i = 0;
+    while (i < width) {
+        double cx = floor((ox + (first + i) * dx) * frequency);
+        hash2_cell_setup(&cell, seed, cx, fy, y);
+
+        int end = i + 1;
+        while (end < width) {
+            double sx = (ox + (first + end) * dx) * frequency;
+            if (sx < cx || sx >= cx + 1.0) {
+                break;
+            }
+            end++;
+        }
+
+        grid2_run(&cell, v, ox, dx, first, frequency, cx, amplitude, total, i, end);
+        i = end;
+    }
+}
+
+void iperlin2_hash_fill_grid(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                             int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                             double* out) {
+    for (int j = 0; j < height; j++) {
+        double* total = out + (size_t) j * width;
+        double y = oy + j * dy;
+
+        for (int i = 0; i < width; i++) {
+            total[i] = 0.0;
+        }
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (int o = 0; o < octaves; o++) {
+            hash2_row_octave(noyc_context_seed(context, o), ox, dx, 0, y * frequency, width,
+                             frequency, amplitude, total);
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (int i = 0; i < width; i++) {
+            total[i] /= max_value;
+        }
+    }
+}
+
+void iperlin2_hash_fill_layers(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                               int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride) {
+    double total[OCTAVE_CHUNK];
+
+    for (int j = 0; j < height; j++) {
+        double y = oy + j * dy;
+        double frequency = bfreq;
+
+        for (int o = 0; o < octaves; o++) {
+            float* layer = layers + o * layer_stride + (size_t) j * width;
+
+            for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+                int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+                for (int i = 0; i < count; i++) {
+                    total[i] = 0.0;
+                }
+
+                hash2_row_octave(noyc_context_seed(context, o), ox, dx, start, y * frequency, count,
+                                 frequency, 1.0, total);
+
+                for (int i = 0; i < count; i++) {
+                    layer[start + i] = (float) total[i];
+                }
+            }
+
+            frequency *= 2;
+        }
+    }
+}
+
+// Hashed 4D noise, on the gradients of iperlin4_at
+__attribute__((always_inline))
+static inline double iperlin4_hash(uint32_t seed, double x, double y, double z, double w) {
+    double fx = floor(x);
+    double fy = floor(y);
+    double fz = floor(z);
+    double fw = floor(w);
+
+    uint32_t x0 = hash_term(fx, HASH_X);
+    uint32_t y0 = hash_term(fy, HASH_Y) ^ seed;
+    uint32_t z0 = hash_term(fz, HASH_Z);
+    uint32_t w0 = hash_term(fw, HASH_W);
+    uint32_t x1 = x0 + HASH_X;
+    uint32_t y1 = (hash_term(fy, HASH_Y) + HASH_Y) ^ seed;
+    uint32_t z1 = z0 + HASH_Z;
+    uint32_t w1 = w0 + HASH_W;
+
+    x -= fx;
+    y -= fy;
+    z -= fz;
+    w -= fw;
+
+    double u = fade(x);
+    double v = fade(y);
+    double s = fade(z);
+    double t = fade(w);
+
+    double xm = x - 1.;
+    double ym = y - 1.;
+    double zm = z - 1.;
+    double wm = w - 1.;
+    return 0.8 * lerp(t, lerp(s, lerp(v, lerp(u, grad4(hash_mix(x0 ^ y0 ^ z0 ^ w0), x , y , z , w),
+                                                 grad4(hash_mix(x1 ^ y0 ^ z0 ^ w0), xm, y , z , w)),
+                                         lerp(u, grad4(hash_mix(x0 ^ y1 ^ z0 ^ w0), x , ym, z , w),
+                                                 grad4(hash_mix(x1 ^ y1 ^ z0 ^ w0), xm, ym, z , w))),
+                                 lerp(v, lerp(u, grad4(hash_mix(x0 ^ y0 ^ z1 ^ w0), x , y , zm, w),
+                                                 grad4(hash_mix(x1 ^ y0 ^ z1 ^ w0), xm, y , zm, w)),
+                                         lerp(u, grad4(hash_mix(x0 ^ y1 ^ z1 ^ w0), x , ym, zm, w),
+                                                 grad4(hash_mix(x1 ^ y1 ^ z1 ^ w0), xm, ym, zm, w)))),
+                         lerp(s, lerp(v, lerp(u, grad4(hash_mix(x0 ^ y0 ^ z0 ^ w1), x , y , z , wm),
+                                                 grad4(hash_mix(x1 ^ y0 ^ z0 ^ w1), xm, y , z , wm)),
+                                         lerp(u, grad4(hash_mix(x0 ^ y1 ^ z0 ^ w1), x , ym, z , wm),
+                                                 grad4(hash_mix(x1 ^ y1 ^ z0 ^ w1), xm, ym, z , wm))),
+                                 lerp(v, lerp(u, grad4(hash_mix(x0 ^ y0 ^ z1 ^ w1), x , y , zm, wm),
+                                                 grad4(hash_mix(x1 ^ y0 ^ z1 ^ w1), xm, y , zm, wm)),
+                                         lerp(u, grad4(hash_mix(x0 ^ y1 ^ z1 ^ w1), x , ym, zm, wm),
+                                                 grad4(hash_mix(x1 ^ y1 ^ z1 ^ w1), xm, ym, zm, wm)))));
+}
+
+double iperlin4_hash_at(const struct noyc_context* context, double x, double y, double z, double w) {
+    return iperlin4_hash(noyc_context_seed(context, 0), x, y, z, w);
+}
+
+double octave_iperlin4_hash_at(const struct noyc_context* context, double x, double y, double z, double w,
+                               int octaves, double persistence, double bfreq, double bamp) {
+    double total = 0.0;
+    double frequency = bfreq;
+    double amplitude = bamp;
+    double max_value = 0.0;
+
+    for (int i = 0; i < octaves; i++) {
+        total += iperlin4_hash(noyc_context_seed(context, i), x * frequency, y * frequency, z * frequency,
+                               w * frequency) * amplitude;
+        max_value += amplitude;
+
+        amplitude *= persistence;
+        frequency *= 2;
+    }
+
+    return total / max_value;
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void hash4_at_n(uint32_t seed, const double* x, const double* y, const double* z, const double* w,
+                       double* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = iperlin4_hash(seed, x[i], y[i], z[i], w[i]);
+    }
+}
+
+void iperlin4_hash_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                        const double* w, double* out, size_t n) {
+    hash4_at_n(noyc_context_seed(context, 0), x, y, z, w, out, n);
+}
+
+static void hash4_row_octave(uint32_t seed, double ox, double dx, int first, double sy, double sz, double sw, int width,
+                             double frequency, double amplitude, double* total) {
+    double sx[OCTAVE_CHUNK];
+    double syv[OCTAVE_CHUNK];
+    double szv[OCTAVE_CHUNK];
+    double swv[OCTAVE_CHUNK];
+    double value[OCTAVE_CHUNK];
+
+    for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+        int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+        for (int i = 0; i < count; i++) {
+            sx[i] = (ox + (first + start + i) * dx) * frequency;
+            syv[i] = sy;
+            szv[i] = sz;
+            swv[i] = sw;
+        }
+
+        hash4_at_n(seed, sx, syv, szv, swv, value, (size_t) count);
+
+        for (int i = 0; i < count; i++) {
+            total[start + i] += value[i] * amplitude;
+        }
+    }
+}
+
+void iperlin4_hash_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                             double dx, double dy, int width, int height, int octaves, double persistence,
+                             double bfreq, double bamp, double* out) {
+    for (int j = 0; j < height; j++) {
+        double* total = out + (size_t) j * width;
+        double y = oy + j * dy;
+
+        for (int i = 0; i < width; i++) {
+            total[i] = 0.0;
+        }
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (int o = 0; o < octaves; o++) {
+            hash4_row_octave(noyc_context_seed(context, o), ox, dx, 0, y * frequency, oz * frequency, ow * frequency,
+                             width, frequency, amplitude, total);
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (int i = 0; i < width; i++) {
+            total[i] /= max_value;
+        }
+    }
+}
+
+void iperlin4_hash_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                               double dx, double dy, int width, int height, int octaves, double bfreq,
+                               float* layers, size_t layer_stride) {
+    double total[OCTAVE_CHUNK];
+
+    for (int j = 0; j < height; j++) {
+        double y = oy + j * dy;
+        double frequency = bfreq;
+
+        for (int o = 0; o < octaves; o++) {
+            float* layer = layers + o * layer_stride + (size_t) j * width;
+
+            for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+                int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+                for (int i = 0; i < count; i++) {
+                    total[i] = 0.0;
+                }
+
+                hash4_row_octave(noyc_context_seed(context, o), ox, dx, start, y * frequency, oz * frequency,
+                                 ow * frequency, count, frequency, 1.0, total);
+
+                for (int i = 0; i < count; i++) {
+                    layer[start + i] = (float) total[i];
+                }
+            }
+
+            frequency *= 2;
+        }
+    }
+}
@@ -7,7 +7,160 @@
 ** Created by Ken Perlin and presented in SIGGRAPH 2002 paper
 */
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "context.h"
+
+// Functions without a context sample noyc_default_context, Ken Perlin's own
+// permutation table. Their *_ctx_* variants hash corners through the tables
+// of the given context, octave functions take the table of every octave.
+
 double iperlin_at(double x, double y, double z);
 double octave_iperlin_at(double x, double y, double z, int octaves, double persistence, double bfreq, double bam);
 
+// Batched variants, out[i] is the same value the scalar functions return for
+// (x[i], y[i], z[i]). Uses the widest SIMD kernel the CPU supports.
+void iperlin_at_n(const double* x, const double* y, const double* z, double* out, size_t n);
+void octave_iperlin_at_n(const double* x, const double* y, const double* z, double* out, size_t n,
+                         int octaves, double persistence, double bfreq, double bamp);
+
+double iperlin_ctx_at(const struct noyc_context* context, double x, double y, double z);
+double octave_iperlin_ctx_at(const struct noyc_context* context, double x, double y, double z, int octaves,
+                             double persistence, double bfreq, double bamp);
+void iperlin_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                      double* out, size_t n);
+void octave_iperlin_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                             double* out, size_t n, int octaves, double persistence, double bfreq, double bamp);
+
+// Octave noise over a regular grid, out[j*width + i] equals
+// octave_iperlin_at(ox + i*dx, oy + j*dy, oz, ...). Lattice cell work is
+// shared by every sample that falls into the same cell, so low frequencies
+// cost little more than a few multiply-adds per sample.
+void iperlin_fill_grid(double ox, double oy, double oz, double dx, double dy, int width, int height,
+                       int octaves, double persistence, double bfreq, double bamp, double* out);
+void iperlin_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                           int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                           double* out);
+
+// Unweighted octaves over a regular grid as float layers. Octave o of
+// sample (i, j) is stored at layers[o*layer_stride + j*width + i] and is
+// iperlin_at of the sample scaled by bfreq * 2^o, so the layers stay valid
+// for any persistence and amplitude.
+void iperlin_fill_layers(double ox, double oy, double oz, double dx, double dy, int width, int height,
+                         int octaves, double bfreq, float* layers, size_t layer_stride);
+void iperlin_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                             int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride);
+// Weighted sum of n samples of every layer, the same normalised octave sum
+// iperlin_fill_grid computes, in float precision. Cheap enough to redo on
+// every persistence or amplitude change.
+void iperlin_combine_layers(const float* layers, size_t layer_stride, size_t n,
+                            int octaves, double persistence, double bamp, double* out);
+
+// Value and partial derivatives from one evaluation, the value is the one
+// iperlin_at or octave_iperlin_at returns. Batched variants store the
+// derivatives of point i at dx[i], dy[i] and dz[i].
+double iperlin_at_d(double x, double y, double z, double* dx, double* dy, double* dz);
+double octave_iperlin_at_d(double x, double y, double z, int octaves, double persistence, double bfreq, double bamp,
+                           double* dx, double* dy, double* dz);
+void iperlin_at_d_n(const double* x, const double* y, const double* z, double* out,
+                    double* dx, double* dy, double* dz, size_t n);
+void octave_iperlin_at_d_n(const double* x, const double* y, const double* z, double* out,
+                           double* dx, double* dy, double* dz, size_t n,
+                           int octaves, double persistence, double bfreq, double bamp);
+
+double iperlin_ctx_at_d(const struct noyc_context* context, double x, double y, double z,
+                        double* dx, double* dy, double* dz);
+double octave_iperlin_ctx_at_d(const struct noyc_context* context, double x, double y, double z, int octaves,
+                               double persistence, double bfreq, double bamp, double* dx, double* dy, double* dz);
+void iperlin_ctx_at_d_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                        double* out, double* dx, double* dy, double* dz, size_t n);
+void octave_iperlin_ctx_at_d_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                               double* out, double* dx, double* dy, double* dz, size_t n,
+                               int octaves, double persistence, double bfreq, double bamp);
+
+// 2D variants of all of the above. The gradient set is the 3D one projected
+// onto z == 0, so these match the 3D functions at z == 0 at half the cost.
+double iperlin2_at(double x, double y);
+double octave_iperlin2_at(double x, double y, int octaves, double persistence, double bfreq, double bamp);
+void iperlin2_at_n(const double* x, const double* y, double* out, size_t n);
+void octave_iperlin2_at_n(const double* x, const double* y, double* out, size_t n,
+                          int octaves, double persistence, double bfreq, double bamp);
+void iperlin2_fill_grid(double ox, double oy, double dx, double dy, int width, int height,
+                        int octaves, double persistence, double bfreq, double bamp, double* out);
+void iperlin2_fill_layers(double ox, double oy, double dx, double dy, int width, int height,
+                          int octaves, double bfreq, float* layers, size_t layer_stride);
+
+double iperlin2_ctx_at(const struct noyc_context* context, double x, double y);
+double octave_iperlin2_ctx_at(const struct noyc_context* context, double x, double y, int octaves, double persistence,
+                              double bfreq, double bamp);
+void iperlin2_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, double* out, size_t n);
+void octave_iperlin2_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, double* out,
+                              size_t n, int octaves, double persistence, double bfreq, double bamp);
+void iperlin2_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                            int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                            double* out);
+void iperlin2_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                              int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride);
+
+// 4D variants, the grid and layers lie in the plane at (oz, ow). A circle
+// through z and w gives animations that loop.
+double iperlin4_at(double x, double y, double z, double w);
+double octave_iperlin4_at(double x, double y, double z, double w, int octaves, double persistence,
+                          double bfreq, double bamp);
+void iperlin4_at_n(const double* x, const double* y, const double* z, const double* w, double* out, size_t n);
+void iperlin4_fill_grid(double ox, double oy, double oz, double ow, double dx, double dy, int width, int height,
+                        int octaves, double persistence, double bfreq, double bamp, double* out);
+void iperlin4_fill_layers(double ox, double oy, double oz, double ow, double dx, double dy, int width, int height,
+                          int octaves, double bfreq, float* layers, size_t layer_stride);
+
+double iperlin4_ctx_at(const struct noyc_context* context, double x, double y, double z, double w);
+double octave_iperlin4_ctx_at(const struct noyc_context* context, double x, double y, double z, double w,
+                              int octaves, double persistence, double bfreq, double bamp);
+void iperlin4_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                       const double* w, double* out, size_t n);
+void iperlin4_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                            double dx, double dy, int width, int height, int octaves, double persistence,
+                            double bfreq, double bamp, double* out);
+void iperlin4_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                              double dx, double dy, int width, int height, int octaves, double bfreq,
+                              float* layers, size_t layer_stride);
+
+// Everything above on a lattice hashed from the context seed instead of a
+// permutation table. Periods are 2^32 instead of 256 units, different seeds
+// give unrelated noise and the batched functions vectorize without gathers.
+// Coordinates have to fit an int once scaled by the octave frequency.
+double iperlin_hash_at(const struct noyc_context* context, double x, double y, double z);
+double octave_iperlin_hash_at(const struct noyc_context* context, double x, double y, double z, int octaves,
+                              double persistence, double bfreq, double bamp);
+void iperlin_hash_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                       double* out, size_t n);
+void iperlin_hash_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                            int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                            double* out);
+void iperlin_hash_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                              int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride);
+
+double iperlin2_hash_at(const struct noyc_context* context, double x, double y);
+double octave_iperlin2_hash_at(const struct noyc_context* context, double x, double y, int octaves,
+                               double persistence, double bfreq, double bamp);
+void iperlin2_hash_at_n(const struct noyc_context* context, const double* x, const double* y, double* out, size_t n);
+void iperlin2_hash_fill_grid(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                             int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                             double* out);
+void iperlin2_hash_fill_layers(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                               int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride);
+
+double iperlin4_hash_at(const struct noyc_context* context, double x, double y, double z, double w);
+double octave_iperlin4_hash_at(const struct noyc_context* context, double x, double y, double z, double w,
+                               int octaves, double persistence, double bfreq, double bamp);
+void iperlin4_hash_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                        const double* w, double* out, size_t n);
+void iperlin4_hash_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                             double dx, double dy, int width, int height, int octaves, double persistence,
+                             double bfreq, double bamp, double* out);
+void iperlin4_hash_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                               double dx, double dy, int width, int height, int octaves, double bfreq,
+                               float* layers, size_t layer_stride);
+
 #endif // IPERLIN_H_
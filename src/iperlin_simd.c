@@ -0,0 +1,778 @@
+#include "iperlin_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+/*
+** SSE2, 2 samples per vector
+**
+** SSE2 has neither a floor instruction nor gathers, so floor is emulated
+** through truncation and the permutation lookups are done per lane.
+*/
+
+static inline __m128d sse2_select(__m128d mask, __m128d a, __m128d b) {
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+static inline __m128d sse2_floor(__m128d x) {
+    // Keep the sign of x so that floor(-0.0) stays -0.0 like libm does
+    __m128d t = _mm_or_pd(_mm_cvtepi32_pd(_mm_cvttpd_epi32(x)),
+                          _mm_and_pd(x, _mm_set1_pd(-0.0)));
+    return _mm_sub_pd(t, _mm_and_pd(_mm_cmpgt_pd(t, x), _mm_set1_pd(1.0)));
+}
+
+static inline __m128d sse2_fade(__m128d t) {
+    __m128d t3 = _mm_mul_pd(_mm_mul_pd(t, t), t);
+    __m128d inner = _mm_sub_pd(_mm_mul_pd(t, _mm_set1_pd(6.0)), _mm_set1_pd(15.0));
+    return _mm_mul_pd(t3, _mm_add_pd(_mm_mul_pd(t, inner), _mm_set1_pd(10.0)));
+}
+
+static inline __m128d sse2_lerp(__m128d t, __m128d a, __m128d b) {
+    return _mm_add_pd(a, _mm_mul_pd(t, _mm_sub_pd(b, a)));
+}
+
+static inline __m128d sse2_grad(__m128i hash, __m128d x, __m128d y, __m128d z) {
+    __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+    __m128d hd = _mm_cvtepi32_pd(h);
+    __m128d lt8 = _mm_cmplt_pd(hd, _mm_set1_pd(8.0));
+    __m128d lt4 = _mm_cmplt_pd(hd, _mm_set1_pd(4.0));
+    // h == 12 || h == 14 is the same as (h & 13) == 12
+    __m128d is_x = _mm_cmpeq_pd(_mm_cvtepi32_pd(_mm_and_si128(h, _mm_set1_epi32(13))), _mm_set1_pd(12.0));
+
+    __m128d u = sse2_select(lt8, x, y);
+    __m128d v = sse2_select(lt4, y, sse2_select(is_x, x, z));
+
+    // Move bit 0 and bit 1 of each hash into the sign bit of its lane
+    __m128i zero = _mm_setzero_si128();
+    __m128i su = _mm_unpacklo_epi32(zero, _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    __m128i sv = _mm_unpacklo_epi32(zero, _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+
+    return _mm_add_pd(_mm_xor_pd(u, _mm_castsi128_pd(su)), _mm_xor_pd(v, _mm_castsi128_pd(sv)));
+}
+
+size_t iperlin_kernel_sse2(const uint8_t* perm, const double* x, const double* y, const double* z,
+                           double* out, size_t n) {
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128i mask = _mm_set1_epi32(255);
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d xv = _mm_loadu_pd(x + i);
+        __m128d yv = _mm_loadu_pd(y + i);
+        __m128d zv = _mm_loadu_pd(z + i);
+
+        __m128d fx = sse2_floor(xv);
+        __m128d fy = sse2_floor(yv);
+        __m128d fz = sse2_floor(zv);
+
+        int X[4], Y[4], Z[4];
+        _mm_storeu_si128((__m128i*) X, _mm_and_si128(_mm_cvttpd_epi32(fx), mask));
+        _mm_storeu_si128((__m128i*) Y, _mm_and_si128(_mm_cvttpd_epi32(fy), mask));
+        _mm_storeu_si128((__m128i*) Z, _mm_and_si128(_mm_cvttpd_epi32(fz), mask));
+
+        xv = _mm_sub_pd(xv, fx);
+        yv = _mm_sub_pd(yv, fy);
+        zv = _mm_sub_pd(zv, fz);
+
+        __m128d u = sse2_fade(xv);
+        __m128d v = sse2_fade(yv);
+        __m128d w = sse2_fade(zv);
+
+        int h[8][4] = {0};
+        for (int l = 0; l < 2; l++) {
+            int A = perm[X[l]] + Y[l];
+            int AA = perm[A] + Z[l];
+            int AB = perm[A+1] + Z[l];
+            int B = perm[X[l]+1] + Y[l];
+            int BA = perm[B] + Z[l];
+            int BB = perm[B+1] + Z[l];
+
+            h[0][l] = perm[AA];
+            h[1][l] = perm[BA];
+            h[2][l] = perm[AB];
+            h[3][l] = perm[BB];
+            h[4][l] = perm[AA+1];
+            h[5][l] = perm[BA+1];
+            h[6][l] = perm[AB+1];
+            h[7][l] = perm[BB+1];
+        }
+
+        __m128d x1 = _mm_sub_pd(xv, one);
+        __m128d y1 = _mm_sub_pd(yv, one);
+        __m128d z1 = _mm_sub_pd(zv, one);
+
+        __m128d g0 = sse2_grad(_mm_loadu_si128((const __m128i*) h[0]), xv, yv, zv);
+        __m128d g1 = sse2_grad(_mm_loadu_si128((const __m128i*) h[1]), x1, yv, zv);
+        __m128d g2 = sse2_grad(_mm_loadu_si128((const __m128i*) h[2]), xv, y1, zv);
+        __m128d g3 = sse2_grad(_mm_loadu_si128((const __m128i*) h[3]), x1, y1, zv);
+        __m128d g4 = sse2_grad(_mm_loadu_si128((const __m128i*) h[4]), xv, yv, z1);
+        __m128d g5 = sse2_grad(_mm_loadu_si128((const __m128i*) h[5]), x1, yv, z1);
+        __m128d g6 = sse2_grad(_mm_loadu_si128((const __m128i*) h[6]), xv, y1, z1);
+        __m128d g7 = sse2_grad(_mm_loadu_si128((const __m128i*) h[7]), x1, y1, z1);
+
+        __m128d r = sse2_lerp(w, sse2_lerp(v, sse2_lerp(u, g0, g1), sse2_lerp(u, g2, g3)),
+                                 sse2_lerp(v, sse2_lerp(u, g4, g5), sse2_lerp(u, g6, g7)));
+        _mm_storeu_pd(out + i, r);
+    }
+
+    return i;
+}
+
+static inline __m128d sse2_grad2(__m128i hash, __m128d x, __m128d y) {
+    __m128i h = _mm_and_si128(hash, _mm_set1_epi32(15));
+    __m128d hd = _mm_cvtepi32_pd(h);
+    __m128d lt8 = _mm_cmplt_pd(hd, _mm_set1_pd(8.0));
+    __m128d lt4 = _mm_cmplt_pd(hd, _mm_set1_pd(4.0));
+    __m128d is_x = _mm_cmpeq_pd(_mm_cvtepi32_pd(_mm_and_si128(h, _mm_set1_epi32(13))), _mm_set1_pd(12.0));
+
+    // The z component is zero, so it drops out of v
+    __m128d u = sse2_select(lt8, x, y);
+    __m128d v = sse2_select(lt4, y, _mm_and_pd(is_x, x));
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i su = _mm_unpacklo_epi32(zero, _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    __m128i sv = _mm_unpacklo_epi32(zero, _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+
+    return _mm_add_pd(_mm_xor_pd(u, _mm_castsi128_pd(su)), _mm_xor_pd(v, _mm_castsi128_pd(sv)));
+}
+
+size_t iperlin2_kernel_sse2(const uint8_t* perm, const double* x, const double* y, double* out, size_t n) {
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128i mask = _mm_set1_epi32(255);
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d xv = _mm_loadu_pd(x + i);
+        __m128d yv = _mm_loadu_pd(y + i);
+
+        __m128d fx = sse2_floor(xv);
+        __m128d fy = sse2_floor(yv);
+
+        int X[4], Y[4];
+        _mm_storeu_si128((__m128i*) X, _mm_and_si128(_mm_cvttpd_epi32(fx), mask));
+        _mm_storeu_si128((__m128i*) Y, _mm_and_si128(_mm_cvttpd_epi32(fy), mask));
+
+        xv = _mm_sub_pd(xv, fx);
+        yv = _mm_sub_pd(yv, fy);
+
+        __m128d u = sse2_fade(xv);
+        __m128d v = sse2_fade(yv);
+
+        int h[4][4] = {0};
+        for (int l = 0; l < 2; l++) {
+            int A = perm[X[l]] + Y[l];
+            int B = perm[X[l]+1] + Y[l];
+
+            h[0][l] = perm[perm[A]];
+            h[1][l] = perm[perm[B]];
+            h[2][l] = perm[perm[A+1]];
+            h[3][l] = perm[perm[B+1]];
+        }
+
+        __m128d x1 = _mm_sub_pd(xv, one);
+        __m128d y1 = _mm_sub_pd(yv, one);
+
+        __m128d g0 = sse2_grad2(_mm_loadu_si128((const __m128i*) h[0]), xv, yv);
+        __m128d g1 = sse2_grad2(_mm_loadu_si128((const __m128i*) h[1]), x1, yv);
+        __m128d g2 = sse2_grad2(_mm_loadu_si128((const __m128i*) h[2]), xv, y1);
+        __m128d g3 = sse2_grad2(_mm_loadu_si128((const __m128i*) h[3]), x1, y1);
+
+        _mm_storeu_pd(out + i, sse2_lerp(v, sse2_lerp(u, g0, g1), sse2_lerp(u, g2, g3)));
+    }
+
+    return i;
+}
+
+/*
+** AVX2, 4 samples per vector
+**
+** Lattice indices live in 32 bit lanes so every permutation lookup is a
+** single gather, gradient selection is done with 64 bit compares and blends.
+*/
+
+// Gathers 4 bytes at every index of the byte table and keeps the first, the
+// padding at the end of the table keeps the last index in bounds
+__attribute__((target("avx2")))
+static inline __m128i avx2_perm(const uint8_t* perm, __m128i index) {
+    return _mm_and_si128(_mm_i32gather_epi32((const int*) perm, index, 1), _mm_set1_epi32(255));
+}
+
+__attribute__((target("avx2")))
+static inline __m256d avx2_fade(__m256d t) {
+    __m256d t3 = _mm256_mul_pd(_mm256_mul_pd(t, t), t);
+    __m256d inner = _mm256_sub_pd(_mm256_mul_pd(t, _mm256_set1_pd(6.0)), _mm256_set1_pd(15.0));
+    return _mm256_mul_pd(t3, _mm256_add_pd(_mm256_mul_pd(t, inner), _mm256_set1_pd(10.0)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256d avx2_lerp(__m256d t, __m256d a, __m256d b) {
+    return _mm256_add_pd(a, _mm256_mul_pd(t, _mm256_sub_pd(b, a)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256d avx2_grad(__m128i hash, __m256d x, __m256d y, __m256d z) {
+    __m256i h = _mm256_cvtepi32_epi64(_mm_and_si128(hash, _mm_set1_epi32(15)));
+    __m256d lt8 = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(8), h));
+    __m256d lt4 = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(4), h));
+    // h == 12 || h == 14 is the same as (h & 13) == 12
+    __m256d is_x = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(h, _mm256_set1_epi64x(13)),
+                                                          _mm256_set1_epi64x(12)));
+
+    __m256d u = _mm256_blendv_pd(y, x, lt8);
+    __m256d v = _mm256_blendv_pd(_mm256_blendv_pd(z, x, is_x), y, lt4);
+
+    __m256i su = _mm256_slli_epi64(_mm256_and_si256(h, _mm256_set1_epi64x(1)), 63);
+    __m256i sv = _mm256_slli_epi64(_mm256_and_si256(h, _mm256_set1_epi64x(2)), 62);
+
+    return _mm256_add_pd(_mm256_xor_pd(u, _mm256_castsi256_pd(su)), _mm256_xor_pd(v, _mm256_castsi256_pd(sv)));
+}
+
+__attribute__((target("avx2")))
+size_t iperlin_kernel_avx2(const uint8_t* perm, const double* x, const double* y, const double* z,
+                           double* out, size_t n) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m128i mask = _mm_set1_epi32(255);
+    const __m128i inc = _mm_set1_epi32(1);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d xv = _mm256_loadu_pd(x + i);
+        __m256d yv = _mm256_loadu_pd(y + i);
+        __m256d zv = _mm256_loadu_pd(z + i);
+
+        __m256d fx = _mm256_floor_pd(xv);
+        __m256d fy = _mm256_floor_pd(yv);
+        __m256d fz = _mm256_floor_pd(zv);
+
+        __m128i X = _mm_and_si128(_mm256_cvttpd_epi32(fx), mask);
+        __m128i Y = _mm_and_si128(_mm256_cvttpd_epi32(fy), mask);
+        __m128i Z = _mm_and_si128(_mm256_cvttpd_epi32(fz), mask);
+
+        xv = _mm256_sub_pd(xv, fx);
+        yv = _mm256_sub_pd(yv, fy);
+        zv = _mm256_sub_pd(zv, fz);
+
+        __m256d u = avx2_fade(xv);
+        __m256d v = avx2_fade(yv);
+        __m256d w = avx2_fade(zv);
+
+        __m128i A = _mm_add_epi32(avx2_perm(perm, X), Y);
+        __m128i AA = _mm_add_epi32(avx2_perm(perm, A), Z);
+        __m128i AB = _mm_add_epi32(avx2_perm(perm, _mm_add_epi32(A, inc)), Z);
+        __m128i B = _mm_add_epi32(avx2_perm(perm, _mm_add_epi32(X, inc)), Y);
+        __m128i BA = _mm_add_epi32(avx2_perm(perm, B), Z);
+        __m128i BB = _mm_add_epi32(avx2_perm(perm, _mm_add_epi32(B, inc)), Z);
+
+        __m256d x1 = _mm256_sub_pd(xv, one);
+        __m256d y1 = _mm256_sub_pd(yv, one);
+        __m256d z1 = _mm256_sub_pd(zv, one);
+
+        __m256d g0 = avx2_grad(avx2_perm(perm, AA), xv, yv, zv);
+        __m256d g1 = avx2_grad(avx2_perm(perm, BA), x1, yv, zv);
+        __m256d g2 = avx2_grad(avx2_perm(perm, AB), xv, y1, zv);
+        __m256d g3 = avx2_grad(avx2_perm(perm, BB), x1, y1, zv);
+        __m256d g4 = avx2_grad(avx2_perm(perm, _mm_add_epi32(AA, inc)), xv, yv, z1);
+        __m256d g5 = avx2_grad(avx2_perm(perm, _mm_add_epi32(BA, inc)), x1, yv, z1);
+        __m256d g6 = avx2_grad(avx2_perm(perm, _mm_add_epi32(AB, inc)), xv, y1, z1);
+        __m256d g7 = avx2_grad(avx2_perm(perm, _mm_add_epi32(BB, inc)), x1, y1, z1);
+
+        __m256d r = avx2_lerp(w, avx2_lerp(v, avx2_lerp(u, g0, g1), avx2_lerp(u, g2, g3)),
+                                 avx2_lerp(v, avx2_lerp(u, g4, g5), avx2_lerp(u, g6, g7)));
+        _mm256_storeu_pd(out + i, r);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static inline __m256d avx2_dfade(__m256d t) {
+    __m256d inner = _mm256_add_pd(_mm256_mul_pd(t, _mm256_sub_pd(t, _mm256_set1_pd(2.0))), _mm256_set1_pd(1.0));
+    return _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(30.0), t), t), inner);
+}
+
+// Value of a corner in c[0] and its gradient vector in c[1], c[2] and c[3]
+__attribute__((target("avx2")))
+static inline void avx2_corner_d(__m128i hash, __m256d x, __m256d y, __m256d z, __m256d* c) {
+    __m256i h = _mm256_cvtepi32_epi64(_mm_and_si128(hash, _mm_set1_epi32(15)));
+    __m256d lt8 = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(8), h));
+    __m256d lt4 = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(4), h));
+    __m256d is_x = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(h, _mm256_set1_epi64x(13)),
+                                                          _mm256_set1_epi64x(12)));
+
+    __m256d one = _mm256_set1_pd(1.0);
+    __m256d su = _mm256_xor_pd(one, _mm256_castsi256_pd(
+        _mm256_slli_epi64(_mm256_and_si256(h, _mm256_set1_epi64x(1)), 63)));
+    __m256d sv = _mm256_xor_pd(one, _mm256_castsi256_pd(
+        _mm256_slli_epi64(_mm256_and_si256(h, _mm256_set1_epi64x(2)), 62)));
+
+    c[0] = avx2_grad(hash, x, y, z);
+    c[1] = _mm256_add_pd(_mm256_and_pd(lt8, su), _mm256_and_pd(is_x, sv));
+    c[2] = _mm256_add_pd(_mm256_andnot_pd(lt8, su), _mm256_and_pd(lt4, sv));
+    c[3] = _mm256_andnot_pd(_mm256_or_pd(lt4, is_x), sv);
+}
+
+// Lerp of a value and its derivatives along axis, see lerp_d in iperlin.c
+__attribute__((target("avx2")))
+static inline void avx2_lerp_d(__m256d t, __m256d dt, int axis, const __m256d* a, const __m256d* b, __m256d* r) {
+    for (int k = 0; k < 4; k++) {
+        r[k] = avx2_lerp(t, a[k], b[k]);
+    }
+    r[1 + axis] = _mm256_add_pd(r[1 + axis], _mm256_mul_pd(dt, _mm256_sub_pd(b[0], a[0])));
+}
+
+__attribute__((target("avx2")))
+size_t iperlin_d_kernel_avx2(const uint8_t* perm, const double* x, const double* y, const double* z,
+                             double* out, double* dx, double* dy, double* dz, size_t n) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m128i mask = _mm_set1_epi32(255);
+    const __m128i inc = _mm_set1_epi32(1);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d xv = _mm256_loadu_pd(x + i);
+        __m256d yv = _mm256_loadu_pd(y + i);
+        __m256d zv = _mm256_loadu_pd(z + i);
+
+        __m256d fx = _mm256_floor_pd(xv);
+        __m256d fy = _mm256_floor_pd(yv);
+        __m256d fz = _mm256_floor_pd(zv);
+
+        __m128i X = _mm_and_si128(_mm256_cvttpd_epi32(fx), mask);
+        __m128i Y = _mm_and_si128(_mm256_cvttpd_epi32(fy), mask);
+        __m128i Z = _mm_and_si128(_mm256_cvttpd_epi32(fz), mask);
+
+        xv = _mm256_sub_pd(xv, fx);
+        yv = _mm256_sub_pd(yv, fy);
+        zv = _mm256_sub_pd(zv, fz);
+
+        __m256d u = avx2_fade(xv);
+        __m256d v = avx2_fade(yv);
+        __m256d w = avx2_fade(zv);
+        __m256d du = avx2_dfade(xv);
+        __m256d dv = avx2_dfade(yv);
+        __m256d dw = avx2_dfade(zv);
+
+        __m128i A = _mm_add_epi32(avx2_perm(perm, X), Y);
+        __m128i AA = _mm_add_epi32(avx2_perm(perm, A), Z);
+        __m128i AB = _mm_add_epi32(avx2_perm(perm, _mm_add_epi32(A, inc)), Z);
+        __m128i B = _mm_add_epi32(avx2_perm(perm, _mm_add_epi32(X, inc)), Y);
+        __m128i BA = _mm_add_epi32(avx2_perm(perm, B), Z);
+        __m128i BB = _mm_add_epi32(avx2_perm(perm, _mm_add_epi32(B, inc)), Z);
+
+        __m256d x1 = _mm256_sub_pd(xv, one);
+        __m256d y1 = _mm256_sub_pd(yv, one);
+        __m256d z1 = _mm256_sub_pd(zv, one);
+
+        __m256d c[8][4];
+        avx2_corner_d(avx2_perm(perm, AA), xv, yv, zv, c[0]);
+        avx2_corner_d(avx2_perm(perm, BA), x1, yv, zv, c[1]);
+        avx2_corner_d(avx2_perm(perm, AB), xv, y1, zv, c[2]);
+        avx2_corner_d(avx2_perm(perm, BB), x1, y1, zv, c[3]);
+        avx2_corner_d(avx2_perm(perm, _mm_add_epi32(AA, inc)), xv, yv, z1, c[4]);
+        avx2_corner_d(avx2_perm(perm, _mm_add_epi32(BA, inc)), x1, yv, z1, c[5]);
+        avx2_corner_d(avx2_perm(perm, _mm_add_epi32(AB, inc)), xv, y1, z1, c[6]);
+        avx2_corner_d(avx2_perm(perm, _mm_add_epi32(BB, inc)), x1, y1, z1, c[7]);
+
+        __m256d ex[4][4];
+        __m256d ey[2][4];
+        __m256d r[4];
+        avx2_lerp_d(u, du, 0, c[0], c[1], ex[0]);
+        avx2_lerp_d(u, du, 0, c[2], c[3], ex[1]);
+        avx2_lerp_d(u, du, 0, c[4], c[5], ex[2]);
+        avx2_lerp_d(u, du, 0, c[6], c[7], ex[3]);
+        avx2_lerp_d(v, dv, 1, ex[0], ex[1], ey[0]);
+        avx2_lerp_d(v, dv, 1, ex[2], ex[3], ey[1]);
+        avx2_lerp_d(w, dw, 2, ey[0], ey[1], r);
+
+        _mm256_storeu_pd(out + i, r[0]);
+        _mm256_storeu_pd(dx + i, r[1]);
+        _mm256_storeu_pd(dy + i, r[2]);
+        _mm256_storeu_pd(dz + i, r[3]);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static inline __m256d avx2_grad2(__m128i hash, __m256d x, __m256d y) {
+    __m256i h = _mm256_cvtepi32_epi64(_mm_and_si128(hash, _mm_set1_epi32(15)));
+    __m256d lt8 = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(8), h));
+    __m256d lt4 = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(4), h));
+    __m256d is_x = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(h, _mm256_set1_epi64x(13)),
+                                                          _mm256_set1_epi64x(12)));
+
+    // The z component is zero, so it drops out of v
+    __m256d u = _mm256_blendv_pd(y, x, lt8);
+    __m256d v = _mm256_blendv_pd(_mm256_and_pd(is_x, x), y, lt4);
+
+    __m256i su = _mm256_slli_epi64(_mm256_and_si256(h, _mm256_set1_epi64x(1)), 63);
+    __m256i sv = _mm256_slli_epi64(_mm256_and_si256(h, _mm256_set1_epi64x(2)), 62);
+
+    return _mm256_add_pd(_mm256_xor_pd(u, _mm256_castsi256_pd(su)), _mm256_xor_pd(v, _mm256_castsi256_pd(sv)));
+}
+
+__attribute__((target("avx2")))
+size_t iperlin2_kernel_avx2(const uint8_t* perm, const double* x, const double* y, double* out, size_t n) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m128i mask = _mm_set1_epi32(255);
+    const __m128i inc = _mm_set1_epi32(1);
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d xv = _mm256_loadu_pd(x + i);
+        __m256d yv = _mm256_loadu_pd(y + i);
+
+        __m256d fx = _mm256_floor_pd(xv);
+        __m256d fy = _mm256_floor_pd(yv);
+
+        __m128i X = _mm_and_si128(_mm256_cvttpd_epi32(fx), mask);
+        __m128i Y = _mm_and_si128(_mm256_cvttpd_epi32(fy), mask);
+
+        xv = _mm256_sub_pd(xv, fx);
+        yv = _mm256_sub_pd(yv, fy);
+
+        __m256d u = avx2_fade(xv);
+        __m256d v = avx2_fade(yv);
+
+        __m128i A = _mm_add_epi32(avx2_perm(perm, X), Y);
+        __m128i B = _mm_add_epi32(avx2_perm(perm, _mm_add_epi32(X, inc)), Y);
+        __m128i AA = avx2_perm(perm, A);
+        __m128i AB = avx2_perm(perm, _mm_add_epi32(A, inc));
+        __m128i BA = avx2_perm(perm, B);
+        __m128i BB = avx2_perm(perm, _mm_add_epi32(B, inc));
+
+        __m256d x1 = _mm256_sub_pd(xv, one);
+        __m256d y1 = _mm256_sub_pd(yv, one);
+
+        __m256d g0 = avx2_grad2(avx2_perm(perm, AA), xv, yv);
+        __m256d g1 = avx2_grad2(avx2_perm(perm, BA), x1, yv);
+        __m256d g2 = avx2_grad2(avx2_perm(perm, AB), xv, y1);
+        __m256d g3 = avx2_grad2(avx2_perm(perm, BB), x1, y1);
+
+        _mm256_storeu_pd(out + i, avx2_lerp(v, avx2_lerp(u, g0, g1), avx2_lerp(u, g2, g3)));
+    }
+
+    return i;
+}
+
+/*
+** AVX-512, 8 samples per vector
+**
+** Same shape as the AVX2 kernel, gradient selection uses mask registers.
+*/
+
+__attribute__((target("avx512f")))
+static inline __m256i avx512_perm(const uint8_t* perm, __m256i index) {
+    return _mm256_and_si256(_mm256_i32gather_epi32((const int*) perm, index, 1), _mm256_set1_epi32(255));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d avx512_fade(__m512d t) {
+    __m512d t3 = _mm512_mul_pd(_mm512_mul_pd(t, t), t);
+    __m512d inner = _mm512_sub_pd(_mm512_mul_pd(t, _mm512_set1_pd(6.0)), _mm512_set1_pd(15.0));
+    return _mm512_mul_pd(t3, _mm512_add_pd(_mm512_mul_pd(t, inner), _mm512_set1_pd(10.0)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d avx512_lerp(__m512d t, __m512d a, __m512d b) {
+    return _mm512_add_pd(a, _mm512_mul_pd(t, _mm512_sub_pd(b, a)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d avx512_grad(__m256i hash, __m512d x, __m512d y, __m512d z) {
+    __m512i h = _mm512_cvtepi32_epi64(_mm256_and_si256(hash, _mm256_set1_epi32(15)));
+    __mmask8 lt8 = _mm512_cmplt_epi64_mask(h, _mm512_set1_epi64(8));
+    __mmask8 lt4 = _mm512_cmplt_epi64_mask(h, _mm512_set1_epi64(4));
+    // h == 12 || h == 14 is the same as (h & 13) == 12
+    __mmask8 is_x = _mm512_cmpeq_epi64_mask(_mm512_and_si512(h, _mm512_set1_epi64(13)), _mm512_set1_epi64(12));
+
+    __m512d u = _mm512_mask_blend_pd(lt8, y, x);
+    __m512d v = _mm512_mask_blend_pd(lt4, _mm512_mask_blend_pd(is_x, z, x), y);
+
+    __m512i su = _mm512_slli_epi64(_mm512_and_si512(h, _mm512_set1_epi64(1)), 63);
+    __m512i sv = _mm512_slli_epi64(_mm512_and_si512(h, _mm512_set1_epi64(2)), 62);
+
+    return _mm512_add_pd(_mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(u), su)),
+                         _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(v), sv)));
+}
+
+__attribute__((target("avx512f")))
+size_t iperlin_kernel_avx512(const uint8_t* perm, const double* x, const double* y, const double* z,
+                             double* out, size_t n) {
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m256i mask = _mm256_set1_epi32(255);
+    const __m256i inc = _mm256_set1_epi32(1);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d xv = _mm512_loadu_pd(x + i);
+        __m512d yv = _mm512_loadu_pd(y + i);
+        __m512d zv = _mm512_loadu_pd(z + i);
+
+        __m512d fx = _mm512_roundscale_pd(xv, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512d fy = _mm512_roundscale_pd(yv, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512d fz = _mm512_roundscale_pd(zv, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+
+        __m256i X = _mm256_and_si256(_mm512_cvttpd_epi32(fx), mask);
+        __m256i Y = _mm256_and_si256(_mm512_cvttpd_epi32(fy), mask);
+        __m256i Z = _mm256_and_si256(_mm512_cvttpd_epi32(fz), mask);
+
+        xv = _mm512_sub_pd(xv, fx);
+        yv = _mm512_sub_pd(yv, fy);
+        zv = _mm512_sub_pd(zv, fz);
+
+        __m512d u = avx512_fade(xv);
+        __m512d v = avx512_fade(yv);
+        __m512d w = avx512_fade(zv);
+
+        __m256i A = _mm256_add_epi32(avx512_perm(perm, X), Y);
+        __m256i AA = _mm256_add_epi32(avx512_perm(perm, A), Z);
+        __m256i AB = _mm256_add_epi32(avx512_perm(perm, _mm256_add_epi32(A, inc)), Z);
+        __m256i B = _mm256_add_epi32(avx512_perm(perm, _mm256_add_epi32(X, inc)), Y);
+        __m256i BA = _mm256_add_epi32(avx512_perm(perm, B), Z);
+        __m256i BB = _mm256_add_epi32(avx512_perm(perm, _mm256_add_epi32(B, inc)), Z);
+
+        __m512d x1 = _mm512_sub_pd(xv, one);
+        __m512d y1 = _mm512_sub_pd(yv, one);
+        __m512d z1 = _mm512_sub_pd(zv, one);
+
+        __m512d g0 = avx512_grad(avx512_perm(perm, AA), xv, yv, zv);
+        __m512d g1 = avx512_grad(avx512_perm(perm, BA), x1, yv, zv);
+        __m512d g2 = avx512_grad(avx512_perm(perm, AB), xv, y1, zv);
+        __m512d g3 = avx512_grad(avx512_perm(perm, BB), x1, y1, zv);
+        __m512d g4 = avx512_grad(avx512_perm(perm, _mm256_add_epi32(AA, inc)), xv, yv, z1);
+        __m512d g5 = avx512_grad(avx512_perm(perm, _mm256_add_epi32(BA, inc)), x1, yv, z1);
+        __m512d g6 = avx512_grad(avx512_perm(perm, _mm256_add_epi32(AB, inc)), xv, y1, z1);
+        __m512d g7 = avx512_grad(avx512_perm(perm, _mm256_add_epi32(BB, inc)), x1, y1, z1);
+
+        __m512d r = avx512_lerp(w, avx512_lerp(v, avx512_lerp(u, g0, g1), avx512_lerp(u, g2, g3)),
+                                   avx512_lerp(v, avx512_lerp(u, g4, g5), avx512_lerp(u, g6, g7)));
+        _mm512_storeu_pd(out + i, r);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d avx512_dfade(__m512d t) {
+    __m512d inner = _mm512_add_pd(_mm512_mul_pd(t, _mm512_sub_pd(t, _mm512_set1_pd(2.0))), _mm512_set1_pd(1.0));
+    return _mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(30.0), t), t), inner);
+}
+
+__attribute__((target("avx512f")))
+static inline void avx512_corner_d(__m256i hash, __m512d x, __m512d y, __m512d z, __m512d* c) {
+    __m512i h = _mm512_cvtepi32_epi64(_mm256_and_si256(hash, _mm256_set1_epi32(15)));
+    __mmask8 lt8 = _mm512_cmplt_epi64_mask(h, _mm512_set1_epi64(8));
+    __mmask8 lt4 = _mm512_cmplt_epi64_mask(h, _mm512_set1_epi64(4));
+    __mmask8 is_x = _mm512_cmpeq_epi64_mask(_mm512_and_si512(h, _mm512_set1_epi64(13)), _mm512_set1_epi64(12));
+
+    __m512i one = _mm512_castpd_si512(_mm512_set1_pd(1.0));
+    __m512d su = _mm512_castsi512_pd(_mm512_xor_si512(one,
+        _mm512_slli_epi64(_mm512_and_si512(h, _mm512_set1_epi64(1)), 63)));
+    __m512d sv = _mm512_castsi512_pd(_mm512_xor_si512(one,
+        _mm512_slli_epi64(_mm512_and_si512(h, _mm512_set1_epi64(2)), 62)));
+
+    c[0] = avx512_grad(hash, x, y, z);
+    c[1] = _mm512_add_pd(_mm512_maskz_mov_pd(lt8, su), _mm512_maskz_mov_pd(is_x, sv));
+    c[2] = _mm512_add_pd(_mm512_maskz_mov_pd((__mmask8) ~lt8, su), _mm512_maskz_mov_pd(lt4, sv));
+    c[3] = _mm512_maskz_mov_pd((__mmask8) ~(lt4 | is_x), sv);
+}
+
+__attribute__((target("avx512f")))
+static inline void avx512_lerp_d(__m512d t, __m512d dt, int axis, const __m512d* a, const __m512d* b, __m512d* r) {
+    for (int k = 0; k < 4; k++) {
+        r[k] = avx512_lerp(t, a[k], b[k]);
+    }
+    r[1 + axis] = _mm512_add_pd(r[1 + axis], _mm512_mul_pd(dt, _mm512_sub_pd(b[0], a[0])));
+}
+
+__attribute__((target("avx512f")))
+size_t iperlin_d_kernel_avx512(const uint8_t* perm, const double* x, const double* y, const double* z,
+                               double* out, double* dx, double* dy, double* dz, size_t n) {
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m256i mask = _mm256_set1_epi32(255);
+    const __m256i inc = _mm256_set1_epi32(1);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d xv = _mm512_loadu_pd(x + i);
+        __m512d yv = _mm512_loadu_pd(y + i);
+        __m512d zv = _mm512_loadu_pd(z + i);
+
+        __m512d fx = _mm512_roundscale_pd(xv, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512d fy = _mm512_roundscale_pd(yv, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512d fz = _mm512_roundscale_pd(zv, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+
+        __m256i X = _mm256_and_si256(_mm512_cvttpd_epi32(fx), mask);
+        __m256i Y = _mm256_and_si256(_mm512_cvttpd_epi32(fy), mask);
+        __m256i Z = _mm256_and_si256(_mm512_cvttpd_epi32(fz), mask);
+
+        xv = _mm512_sub_pd(xv, fx);
+        yv = _mm512_sub_pd(yv, fy);
+        zv = _mm512_sub_pd(zv, fz);
+
+        __m512d u = avx512_fade(xv);
+        __m512d v = avx512_fade(yv);
+        __m512d w = avx512_fade(zv);
+        __m512d du = avx512_dfade(xv);
+        __m512d dv = avx512_dfade(yv);
+        __m512d dw = avx512_dfade(zv);
+
+        __m256i A = _mm256_add_epi32(avx512_perm(perm, X), Y);
+        __m256i AA = _mm256_add_epi32(avx512_perm(perm, A), Z);
+        __m256i AB = _mm256_add_epi32(avx512_perm(perm, _mm256_add_epi32(A, inc)), Z);
+        __m256i B = _mm256_add_epi32(avx512_perm(perm, _mm256_add_epi32(X, inc)), Y);
+        __m256i BA = _mm256_add_epi32(avx512_perm(perm, B), Z);
+        __m256i BB = _mm256_add_epi32(avx512_perm(perm, _mm256_add_epi32(B, inc)), Z);
+
+        __m512d x1 = _mm512_sub_pd(xv, one);
+        __m512d y1 = _mm512_sub_pd(yv, one);
+        __m512d z1 = _mm512_sub_pd(zv, one);
+
+        __m512d c[8][4];
+        avx512_corner_d(avx512_perm(perm, AA), xv, yv, zv, c[0]);
+        avx512_corner_d(avx512_perm(perm, BA), x1, yv, zv, c[1]);
+        avx512_corner_d(avx512_perm(perm, AB), xv, y1, zv, c[2]);
+        avx512_corner_d(avx512_perm(perm, BB), x1, y1, zv, c[3]);
+        avx512_corner_d(avx512_perm(perm, _mm256_add_epi32(AA, inc)), xv, yv, z1, c[4]);
+        avx512_corner_d(avx512_perm(perm, _mm256_add_epi32(BA, inc)), x1, yv, z1, c[5]);
+        avx512_corner_d(avx512_perm(perm, _mm256_add_epi32(AB, inc)), xv, y1, z1, c[6]);
+        avx512_corner_d(avx512_perm(perm, _mm256_add_epi32(BB, inc)), x1, y1, z1, c[7]);
+
+        __m512d ex[4][4];
+        __m512d ey[2][4];
+        __m512d r[4];
+        avx512_lerp_d(u, du, 0, c[0], c[1], ex[0]);
+        avx512_lerp_d(u, du, 0, c[2], c[3], ex[1]);
+        avx512_lerp_d(u, du, 0, c[4], c[5], ex[2]);
+        avx512_lerp_d(u, du, 0, c[6], c[7], ex[3]);
+        avx512_lerp_d(v, dv, 1, ex[0], ex[1], ey[0]);
+        avx512_lerp_d(v, dv, 1, ex[2], ex[3], ey[1]);
+        avx512_lerp_d(w, dw, 2, ey[0], ey[1], r);
+
+        _mm512_storeu_pd(out + i, r[0]);
+        _mm512_storeu_pd(dx + i, r[1]);
+        _mm512_storeu_pd(dy + i, r[2]);
+        _mm512_storeu_pd(dz + i, r[3]);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d avx512_grad2(__m256i hash, __m512d x, __m512d y) {
+    __m512i h = _mm512_cvtepi32_epi64(_mm256_and_si256(hash, _mm256_set1_epi32(15)));
+    __mmask8 lt8 = _mm512_cmplt_epi64_mask(h, _mm512_set1_epi64(8));
+    __mmask8 lt4 = _mm512_cmplt_epi64_mask(h, _mm512_set1_epi64(4));
+    __mmask8 is_x = _mm512_cmpeq_epi64_mask(_mm512_and_si512(h, _mm512_set1_epi64(13)), _mm512_set1_epi64(12));
+
+    // The z component is zero, so it drops out of v
+    __m512d u = _mm512_mask_blend_pd(lt8, y, x);
+    __m512d v = _mm512_mask_blend_pd(lt4, _mm512_maskz_mov_pd(is_x, x), y);
+
+    __m512i su = _mm512_slli_epi64(_mm512_and_si512(h, _mm512_set1_epi64(1)), 63);
+    __m512i sv = _mm512_slli_epi64(_mm512_and_si512(h, _mm512_set1_epi64(2)), 62);
+
+    return _mm512_add_pd(_mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(u), su)),
+                         _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(v), sv)));
+}
+
+__attribute__((target("avx512f")))
+size_t iperlin2_kernel_avx512(const uint8_t* perm, const double* x, const double* y, double* out, size_t n) {
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m256i mask = _mm256_set1_epi32(255);
+    const __m256i inc = _mm256_set1_epi32(1);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d xv = _mm512_loadu_pd(x + i);
+        __m512d yv = _mm512_loadu_pd(y + i);
+
+        __m512d fx = _mm512_roundscale_pd(xv, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512d fy = _mm512_roundscale_pd(yv, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+
+        __m256i X = _mm256_and_si256(_mm512_cvttpd_epi32(fx), mask);
+        __m256i Y = _mm256_and_si256(_mm512_cvttpd_epi32(fy), mask);
+
+        xv = _mm512_sub_pd(xv, fx);
+        yv = _mm512_sub_pd(yv, fy);
+
+        __m512d u = avx512_fade(xv);
+        __m512d v = avx512_fade(yv);
+
+        __m256i A = _mm256_add_epi32(avx512_perm(perm, X), Y);
+        __m256i B = _mm256_add_epi32(avx512_perm(perm, _mm256_add_epi32(X, inc)), Y);
+        __m256i AA = avx512_perm(perm, A);
+        __m256i AB = avx512_perm(perm, _mm256_add_epi32(A, inc));
+        __m256i BA = avx512_perm(perm, B);
+        __m256i BB = avx512_perm(perm, _mm256_add_epi32(B, inc));
+
+        __m512d x1 = _mm512_sub_pd(xv, one);
+        __m512d y1 = _mm512_sub_pd(yv, one);
+
+        __m512d g0 = avx512_grad2(avx512_perm(perm, AA), xv, yv);
+        __m512d g1 = avx512_grad2(avx512_perm(perm, BA), x1, yv);
+        __m512d g2 = avx512_grad2(avx512_perm(perm, AB), xv, y1);
+        __m512d g3 = avx512_grad2(avx512_perm(perm, BB), x1, y1);
+
+        _mm512_storeu_pd(out + i, avx512_lerp(v, avx512_lerp(u, g0, g1), avx512_lerp(u, g2, g3)));
+    }
+
+    return i;
+}
+
+iperlin_kernel iperlin_select_kernel(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return iperlin_kernel_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return iperlin_kernel_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return iperlin_kernel_sse2;
+    }
+    return NULL;
+}
+
+iperlin_d_kernel iperlin_d_select_kernel(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return iperlin_d_kernel_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return iperlin_d_kernel_avx2;
+    }
+    return NULL;
+}
+
+iperlin2_kernel iperlin2_select_kernel(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return iperlin2_kernel_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return iperlin2_kernel_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return iperlin2_kernel_sse2;
+    }
+    return NULL;
+}
+
+#else
+
+iperlin_kernel iperlin_select_kernel(void) {
+    return NULL;
+}
+
+iperlin_d_kernel iperlin_d_select_kernel(void) {
+    return NULL;
+}
+
+iperlin2_kernel iperlin2_select_kernel(void) {
+    return NULL;
+}
+
+#endif
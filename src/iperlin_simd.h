@@ -0,0 +1,51 @@
+#ifndef IPERLIN_SIMD_H_
+#define IPERLIN_SIMD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** Batched improved Perlin kernels
+**
+** Every kernel evaluates the same operations as iperlin_at, lane by lane and
+** in the same order, so the results are bit-for-bit equal to the scalar path.
+** Kernels only handle whole vectors and return how many points they consumed,
+** the caller finishes the remainder with the scalar function. perm is a
+** byte table of NOYC_PERM_SIZE bytes, see context.h.
+*/
+
+typedef size_t (*iperlin_kernel)(const uint8_t* perm, const double* x, const double* y, const double* z,
+                                 double* out, size_t n);
+
+size_t iperlin_kernel_sse2(const uint8_t* perm, const double* x, const double* y, const double* z,
+                           double* out, size_t n);
+size_t iperlin_kernel_avx2(const uint8_t* perm, const double* x, const double* y, const double* z,
+                           double* out, size_t n);
+size_t iperlin_kernel_avx512(const uint8_t* perm, const double* x, const double* y, const double* z,
+                             double* out, size_t n);
+
+// Picks the widest kernel the running CPU supports, NULL if there is none
+iperlin_kernel iperlin_select_kernel(void);
+
+// Value and partial derivatives as iperlin_at_d returns them. There is no
+// SSE2 kernel, without AVX2 the batched loop of iperlin.c is used instead.
+typedef size_t (*iperlin_d_kernel)(const uint8_t* perm, const double* x, const double* y, const double* z,
+                                   double* out, double* dx, double* dy, double* dz, size_t n);
+
+size_t iperlin_d_kernel_avx2(const uint8_t* perm, const double* x, const double* y, const double* z,
+                             double* out, double* dx, double* dy, double* dz, size_t n);
+size_t iperlin_d_kernel_avx512(const uint8_t* perm, const double* x, const double* y, const double* z,
+                               double* out, double* dx, double* dy, double* dz, size_t n);
+
+iperlin_d_kernel iperlin_d_select_kernel(void);
+
+// 2D kernels, same contract as the 3D ones
+typedef size_t (*iperlin2_kernel)(const uint8_t* perm, const double* x, const double* y, double* out, size_t n);
+
+size_t iperlin2_kernel_sse2(const uint8_t* perm, const double* x, const double* y, double* out, size_t n);
+size_t iperlin2_kernel_avx2(const uint8_t* perm, const double* x, const double* y, double* out, size_t n);
+size_t iperlin2_kernel_avx512(const uint8_t* perm, const double* x, const double* y, double* out, size_t n);
+
+iperlin2_kernel iperlin2_select_kernel(void);
+
+#endif // IPERLIN_SIMD_H_
@@ -2,71 +2,661 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdatomic.h>
 
 #include "img.h"
-#include "iperlin.h"
+#include "noise.h"
+#include "pool.h"
+#include "sample.h"
 
-int main(int argc, char** argv) {
+// Tiles are sized so one tile of doubles stays in L2
+#define TILE_WIDTH 256
+#define TILE_HEIGHT 32
+
+// Each band of rows holds at least this many tiles per thread so workers
+// have something to steal, bands are written out as whole TIFF strips
+#define TILES_PER_THREAD 4
+
+// Everything a worker needs to render any tile of the current band, or any
+// tile of a tiled TIFF.
+//
+// Pages are slices at increasing depth. Strip output counts rows of tiles
+// across all pages, so a band may cover part of one large page or many small
+// ones, and every strip of the file is one row of tiles.
+struct render_job {
+    int width;
+    int height;
+    int tiles_x;
+    int page_tile_rows;
+    size_t band_first;
+    size_t band_y;
 
+    enum noise_engine engine;
+    const struct noyc_context* context;
+    int use_depth;
+    double depth;
+    double depth_step;
     int octaves;
+    double per;
+    double bfreq;
+    double bamp;
+
+    enum tiff_sample_format format;
+    size_t sample_size;
+
+    // Pixels of the current band only
+    uint8_t* noise;
+    // One TILE_WIDTH * TILE_HEIGHT buffer per worker
+    double** scratch;
+
+    // Tiled output, every worker renders whole TIFF tiles into its own
+    // buffer and writes them straight to the file
+    struct tiff_writer* writer;
+    int tile_size;
+    size_t page_tiles;
+    uint8_t** tiles;
+    // Tiles of a mapped file, rendered straight into place
+    uint8_t* mapped;
+
+    // Compressed output, tasks encode into chunks[task] and the caller
+    // appends them in order once the batch starting at chunk_base is done
+    struct tiff_chunk* chunks;
+    size_t chunk_base;
+    atomic_int encode_failed;
+};
+
+static void store_samples(const struct render_job* job, const double* values, uint8_t* dest, int n) {
+    switch (job->format) {
+    case TIFF_SAMPLE_UINT16:
+        samples_to_uint16(values, (uint16_t*) dest, (size_t) n);
+        break;
+    case TIFF_SAMPLE_FLOAT:
+        samples_to_float(values, (float*) dest, (size_t) n);
+        break;
+    default:
+        samples_to_uint8(values, dest, (size_t) n);
+        break;
+    }
+}
+
+// Row of the whole file, counted across pages, where a row of tiles starts
+static size_t tile_row_start(const struct render_job* job, size_t tile_row) {
+    size_t page = tile_row / (size_t) job->page_tile_rows;
+    size_t row = tile_row % (size_t) job->page_tile_rows;
+    return page * (size_t) job->height + row * TILE_HEIGHT;
+}
+
+static double page_depth(const struct render_job* job, size_t page) {
+    return job->depth + job->depth_step * (double) page;
+}
+
+// Renders w x h pixels starting at image position x0, y0 of the slice at
+// depth into dest, in blocks small enough for the scratch buffer. stride is
+// in pixels.
+static void render_region(struct render_job* job, int worker, double depth, int x0, int y0, int w, int h,
+                          uint8_t* dest, size_t stride) {
+    double* values = job->scratch[worker];
+
+    for (int by = 0; by < h; by += TILE_HEIGHT) {
+        for (int bx = 0; bx < w; bx += TILE_WIDTH) {
+            int bw = w - bx < TILE_WIDTH ? w - bx : TILE_WIDTH;
+            int bh = h - by < TILE_HEIGHT ? h - by : TILE_HEIGHT;
+
+            double ox = (double) (x0 + bx);
+            double oy = (double) (y0 + by);
+            if (job->use_depth) {
+                noise_fill_grid(job->engine, job->context, ox, oy, depth, 1.0, 1.0, bw, bh,
+                                job->octaves, job->per, job->bfreq, job->bamp, values);
+            } else {
+                noise2_fill_grid(job->engine, job->context, ox, oy, 1.0, 1.0, bw, bh,
+                                 job->octaves, job->per, job->bfreq, job->bamp, values);
+            }
+
+            for (int y = 0; y < bh; y++) {
+                uint8_t* row = dest + ((size_t)(by + y) * stride + bx) * job->sample_size;
+                store_samples(job, values + y*bw, row, bw);
+            }
+        }
+    }
+}
+
+static void render_tile(void* arg, int task, int worker) {
+    struct render_job* job = (struct render_job*) arg;
+
+    size_t tile_row = job->band_first + (size_t) (task / job->tiles_x);
+    size_t page = tile_row / (size_t) job->page_tile_rows;
+    int x0 = (task % job->tiles_x) * TILE_WIDTH;
+    int y0 = (int) (tile_row % (size_t) job->page_tile_rows) * TILE_HEIGHT;
+    int tw = job->width - x0 < TILE_WIDTH ? job->width - x0 : TILE_WIDTH;
+    int th = job->height - y0 < TILE_HEIGHT ? job->height - y0 : TILE_HEIGHT;
+
+    size_t band_row = tile_row_start(job, tile_row) - job->band_y;
+    render_region(job, worker, page_depth(job, page), x0, y0, tw, th,
+                  job->noise + (band_row * job->width + x0) * job->sample_size, (size_t) job->width);
+}
+
+// Worker tile buffers are reused, edge tiles are zeroed first so their padding
+// does not depend on which tiles the worker rendered before
+static void clear_edge_tile(struct render_job* job, uint8_t* tile, int w, int h) {
+    if (w < job->tile_size || h < job->tile_size) {
+        memset(tile, 0, (size_t) job->tile_size * job->tile_size * job->sample_size);
+    }
+}
+
+// Renders TIFF tile `index`, counted across pages, into tile
+static void render_page_tile(struct render_job* job, int worker, size_t index, uint8_t* tile) {
+    size_t page = index / job->page_tiles;
+    size_t t = index % job->page_tiles;
+
+    int x0 = (int) (t % (size_t) job->tiles_x) * job->tile_size;
+    int y0 = (int) (t / (size_t) job->tiles_x) * job->tile_size;
+    int tw = job->width - x0 < job->tile_size ? job->width - x0 : job->tile_size;
+    int th = job->height - y0 < job->tile_size ? job->height - y0 : job->tile_size;
+
+    // Padding of edge tiles in a mapped file stays zero from the file being
+    // sized up front
+    if (!job->mapped) {
+        clear_edge_tile(job, tile, tw, th);
+    }
+    render_region(job, worker, page_depth(job, page), x0, y0, tw, th, tile, (size_t) job->tile_size);
+}
+
+static void render_tiff_tile(void* arg, int task, int worker) {
+    struct render_job* job = (struct render_job*) arg;
+
+    if (job->mapped) {
+        size_t tile_bytes = (size_t) job->tile_size * job->tile_size * job->sample_size;
+        render_page_tile(job, worker, (size_t) task, job->mapped + (size_t) task * tile_bytes);
+        return;
+    }
+
+    uint8_t* tile = job->tiles[worker];
+    render_page_tile(job, worker, (size_t) task, tile);
+    tiff_writer_write_tile(job->writer, (size_t) task, tile);
+}
+
+// Compressed tiles are rendered and encoded in batches, task is relative to
+// the batch
+static void encode_tiff_tile(void* arg, int task, int worker) {
+    struct render_job* job = (struct render_job*) arg;
+    size_t index = job->chunk_base + (size_t) task;
+
+    uint8_t* tile = job->tiles[worker];
+    render_page_tile(job, worker, index, tile);
+
+    if (tiff_writer_encode(job->writer, index, tile, &job->chunks[task]) < 0) {
+        atomic_store(&job->encode_failed, 1);
+    }
+}
+
+// Strips of the current band, one row of tiles per task
+static void encode_strip(void* arg, int task, int worker) {
+    (void) worker;
+    struct render_job* job = (struct render_job*) arg;
+    size_t index = job->chunk_base + (size_t) task;
+    size_t band_row = tile_row_start(job, index) - job->band_y;
+    const uint8_t* rows = job->noise + band_row * job->width * job->sample_size;
+
+    if (tiff_writer_encode(job->writer, index, rows, &job->chunks[task]) < 0) {
+        atomic_store(&job->encode_failed, 1);
+    }
+}
+
+// Stores the encoded chunks of a batch in chunk order, which keeps the file
+// the same for any number of threads
+static int append_chunks(struct render_job* job, int count) {
+    if (atomic_load(&job->encode_failed)) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (tiff_writer_append(job->writer, job->chunk_base + (size_t) i, &job->chunks[i]) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [options] <int_octaves> <float_persistency> <base_bfreq> <base_bamp> [depth]\n", name);
+    fprintf(stderr, "  -t, --threads N   worker threads, 0 uses every core (default 1)\n");
+    fprintf(stderr, "      --engine E    perlin, simplex or hashed noise (default perlin)\n");
+    fprintf(stderr, "      --seed N      shuffle the permutation table and hash from seed N\n");
+    fprintf(stderr, "      --decorrelate cycle the octaves through 4 tables, one hash seed each\n");
+    fprintf(stderr, "      --width N     image width in pixels (default 1024)\n");
+    fprintf(stderr, "      --height N    image height in pixels (default 1024)\n");
+    fprintf(stderr, "      --tiles N     write a tiled TIFF with N x N tiles, N a multiple of 16\n");
+    fprintf(stderr, "      --compress C  none, packbits, lzw or deflate (default none)\n");
+    fprintf(stderr, "      --predictor   horizontal differencing before lzw or deflate\n");
+    fprintf(stderr, "      --format F    uint8, uint16 or float samples (default uint8)\n");
+    fprintf(stderr, "      --pages N     write N slices at increasing depth as a multi-page TIFF\n");
+    fprintf(stderr, "      --step D      depth between pages (default 1)\n");
+    fprintf(stderr, "      --mmap        generate pixels straight into the mapped file, no compression\n");
+    fprintf(stderr, "  -v, --verbose     report how many tiles each thread rendered\n");
+}
+
+static int parse_int(const char* text, int* value) {
     char* endptr;
+    errno = 0;
+    long parsed = strtol(text, &endptr, 10);
+    if (endptr == text || *endptr != '\0' || errno != 0 || parsed < 0 || parsed > INT32_MAX) {
+        fprintf(stderr, "Invalid number format: %s\n", text);
+        return -1;
+    }
+    *value = (int) parsed;
+    return 0;
+}
+
+static int parse_seed(const char* text, uint32_t* value) {
+    char* endptr;
+    errno = 0;
+    unsigned long long parsed = strtoull(text, &endptr, 10);
+    if (endptr == text || *endptr != '\0' || errno != 0 || text[0] == '-' || parsed > UINT32_MAX) {
+        fprintf(stderr, "Invalid seed: %s\n", text);
+        return -1;
+    }
+    *value = (uint32_t) parsed;
+    return 0;
+}
+
+static int parse_compression(const char* text, enum tiff_compression* value) {
+    if (strcmp(text, "none") == 0) {
+        *value = TIFF_COMPRESSION_NONE;
+    } else if (strcmp(text, "packbits") == 0) {
+        *value = TIFF_COMPRESSION_PACKBITS;
+    } else if (strcmp(text, "lzw") == 0) {
+        *value = TIFF_COMPRESSION_LZW;
+    } else if (strcmp(text, "deflate") == 0) {
+        *value = TIFF_COMPRESSION_DEFLATE;
+    } else {
+        fprintf(stderr, "Unknown compression: %s\n", text);
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_format(const char* text, enum tiff_sample_format* value) {
+    if (strcmp(text, "uint8") == 0) {
+        *value = TIFF_SAMPLE_UINT8;
+    } else if (strcmp(text, "uint16") == 0) {
+        *value = TIFF_SAMPLE_UINT16;
+    } else if (strcmp(text, "float") == 0) {
+        *value = TIFF_SAMPLE_FLOAT;
+    } else {
+        fprintf(stderr, "Unknown sample format: %s\n", text);
+        return -1;
+    }
+    return 0;
+}
 
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s <int_octaves> <float_persistency> <base_bfreq> <base_bamp>\n", argv[0]);
+static int parse_engine(const char* text, enum noise_engine* value) {
+    if (noise_engine_parse(text, value) < 0) {
+        fprintf(stderr, "Unknown noise engine: %s\n", text);
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_double(const char* text, double* value) {
+    char* endptr;
+    *value = strtod(text, &endptr);
+    if (endptr == text || *endptr != '\0') {
+        fprintf(stderr, "Invalid number format: %s\n", text);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+
+    int threads = 1;
+    enum noise_engine engine = NOISE_ENGINE_PERLIN;
+    int seeded = 0;
+    uint32_t seed = 0;
+    int decorrelate = 0;
+    int width = 1024;
+    int height = 1024;
+    int tile_size = 0;
+    enum tiff_compression compression = TIFF_COMPRESSION_NONE;
+    int predictor = 0;
+    enum tiff_sample_format format = TIFF_SAMPLE_UINT8;
+    int mapped = 0;
+    int pages = 1;
+    double depth_step = 1.0;
+    int verbose = 0;
+
+    static const struct option options[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"engine", required_argument, NULL, 'E'},
+        {"seed", required_argument, NULL, 'R'},
+        {"decorrelate", no_argument, NULL, 'D'},
+        {"width", required_argument, NULL, 'W'},
+        {"height", required_argument, NULL, 'H'},
+        {"tiles", required_argument, NULL, 'T'},
+        {"compress", required_argument, NULL, 'C'},
+        {"predictor", no_argument, NULL, 'P'},
+        {"format", required_argument, NULL, 'F'},
+        {"mmap", no_argument, NULL, 'M'},
+        {"pages", required_argument, NULL, 'N'},
+        {"step", required_argument, NULL, 'S'},
+        {"verbose", no_argument, NULL, 'v'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:v", options, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            if (parse_int(optarg, &threads) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'E':
+            if (parse_engine(optarg, &engine) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'R':
+            if (parse_seed(optarg, &seed) < 0) {
+                return EXIT_FAILURE;
+            }
+            seeded = 1;
+            break;
+        case 'D':
+            decorrelate = 1;
+            break;
+        case 'W':
+            if (parse_int(optarg, &width) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'H':
+            if (parse_int(optarg, &height) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            if (parse_int(optarg, &tile_size) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'C':
+            if (parse_compression(optarg, &compression) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'P':
+            predictor = 1;
+            break;
+        case 'F':
+            if (parse_format(optarg, &format) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'M':
+            mapped = 1;
+            break;
+        case 'N':
+            if (parse_int(optarg, &pages) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S':
+            if (parse_double(optarg, &depth_step) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int positional = argc - optind;
+    if (positional != 4 && positional != 5) {
+        usage(argv[0]);
         return EXIT_FAILURE;
     }
+    char** args = argv + optind;
 
-    errno = 0;
+    int octaves;
+    double per;
+    double bfreq;
+    double bamp;
 
-    unsigned long oct = strtoul(argv[1], &endptr, 10);
-    if (endptr == argv[1] || *endptr != '\0') {
-        fprintf(stderr, "Invalid number format: %s\n", argv[1]);
+    if (parse_int(args[0], &octaves) < 0 ||
+        parse_double(args[1], &per) < 0 ||
+        parse_double(args[2], &bfreq) < 0 ||
+        parse_double(args[3], &bamp) < 0) {
         return EXIT_FAILURE;
     }
-    octaves = (int)oct;
 
-    double per = strtod(argv[2], &endptr);
-    if (endptr == argv[2] || *endptr != '\0') {
-        fprintf(stderr, "Invalid number format: %s\n", argv[2]);
+    // Without a depth the image is a slice of 2D noise, which is half the work
+    int use_depth = 0;
+    double depth = 0.0;
+    if (positional == 5) {
+        if (parse_double(args[4], &depth) < 0) {
+            return EXIT_FAILURE;
+        }
+        use_depth = 1;
+    }
+
+    if (width == 0 || height == 0 || pages == 0) {
+        fprintf(stderr, "Image size must not be zero\n");
         return EXIT_FAILURE;
     }
 
-    double bfreq = strtod(argv[3], &endptr);
-    if (endptr == argv[3] || *endptr != '\0') {
-        fprintf(stderr, "Invalid number format: %s\n", argv[3]);
+    // Slices through the volume need 3D noise, starting at depth 0 unless
+    // told otherwise
+    if (pages > 1) {
+        use_depth = 1;
+    }
+
+    if (tile_size % 16 != 0) {
+        fprintf(stderr, "Tile size must be a multiple of 16\n");
         return EXIT_FAILURE;
     }
 
-    double bamp = strtod(argv[4], &endptr);
-    if (endptr == argv[4] || *endptr != '\0') {
-        fprintf(stderr, "Invalid number format: %s\n", argv[4]);
+    // Without a seed the noise keeps Ken Perlin's table, the same image as
+    // ever
+    struct noyc_context context;
+    const struct noyc_context* noise_context = &noyc_default_context;
+    if (seeded || decorrelate) {
+        noyc_context_init(&context, seed, decorrelate);
+        noise_context = &context;
+    }
+
+    struct pool* pool = pool_create(threads);
+    if (!pool) {
+        fprintf(stderr, "Could not start worker threads\n");
         return EXIT_FAILURE;
     }
+    threads = pool_threads(pool);
 
+    int tiles_x = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+    int page_tile_rows = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    size_t total_tile_rows = (size_t) page_tile_rows * pages;
+    size_t total_rows = (size_t) height * pages;
 
-    int width = 1024;
-    int height = 1024;
+    // A mapped file is a single band
+    size_t band_tiles_y = (size_t) (threads * TILES_PER_THREAD + tiles_x - 1) / tiles_x;
+    if (band_tiles_y > total_tile_rows || mapped) {
+        band_tiles_y = total_tile_rows;
+    }
+    size_t band_rows = band_tiles_y * TILE_HEIGHT;
+    if (band_rows > total_rows) {
+        band_rows = total_rows;
+    }
+
+    int failed = 0;
+    size_t sample_size = format == TIFF_SAMPLE_UINT16 ? sizeof(uint16_t)
+        : format == TIFF_SAMPLE_FLOAT ? sizeof(float) : sizeof(uint8_t);
 
-    uint8_t* noise = (uint8_t*) malloc((size_t)(width * height));
-
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            size_t index = (size_t)(y*width + x);
-            /*
-            double n_v = (iperlin_at((double) x / 64.f, (double) y / 64.f, 0.0f) * 1.00 +
-                iperlin_at((double) x / 32.f, (double) y / 32.f, 0.0f) * 0.5f +
-                iperlin_at((double) x / 16.f, (double) y / 16.f, 0.0f) * 0.25f) / 1.75;
-                */
-            double n_v = octave_iperlin_at((double) x, (double) y, 0.0, octaves, per, bfreq, bamp);
-            noise[index] = (uint8_t)((n_v * 0.5 + 0.5) * 255.0);
+    // Strip output is rendered one band at a time, tiled output one tile
+    // per task, so memory use is bounded by a band or a tile per thread. A
+    // mapped file needs neither, it is rendered in one go into the mapping.
+    uint8_t* noise = NULL;
+    if (tile_size == 0 && !mapped) {
+        noise = (uint8_t*) malloc((size_t) width * band_rows * sample_size);
+        failed |= noise == NULL;
+    }
+
+    double** scratch = (double**) calloc((size_t) threads, sizeof(double*));
+    uint8_t** tiles = (uint8_t**) calloc((size_t) threads, sizeof(uint8_t*));
+    failed |= scratch == NULL || tiles == NULL;
+
+    for (int i = 0; !failed && i < threads; i++) {
+        scratch[i] = (double*) malloc(sizeof(double) * TILE_WIDTH * TILE_HEIGHT);
+        failed |= scratch[i] == NULL;
+        if (tile_size > 0 && !mapped) {
+            tiles[i] = (uint8_t*) calloc((size_t) tile_size * tile_size, sample_size);
+            failed |= tiles[i] == NULL;
         }
     }
 
-    if (write_image_to_ttf((const uint8_t*) noise, width, height, 96.0f, "example.tif") < 0) {
-        free(noise);
-        return EXIT_FAILURE;
+    // Compressed chunks of a whole band of strips, or of a batch of tiles,
+    // are held until they can be appended in order
+    int compressed = compression != TIFF_COMPRESSION_NONE;
+    int batch = tile_size > 0 ? threads * TILES_PER_THREAD : (int) band_tiles_y;
+    struct tiff_chunk* chunks = NULL;
+    if (compressed && !failed) {
+        chunks = (struct tiff_chunk*) calloc((size_t) batch, sizeof(struct tiff_chunk));
+        failed |= chunks == NULL;
     }
 
+    if (failed) {
+        fprintf(stderr, "Out of memory\n");
+    }
+
+    struct tiff_options tiff = {
+        .dpi = 96.0f,
+        .rows_per_strip = TILE_HEIGHT,
+        .tile_width = tile_size,
+        .tile_length = tile_size,
+        .compression = compression,
+        .predictor = predictor,
+        .mapped = mapped,
+        .sample_format = format,
+        .pages = pages,
+    };
+
+    struct tiff_writer* writer = NULL;
+    if (!failed) {
+        writer = tiff_writer_open("example.tif", width, height, &tiff);
+        failed = writer == NULL;
+    }
+
+    struct render_job job = {
+        .width = width,
+        .height = height,
+        .tiles_x = tiles_x,
+        .page_tile_rows = page_tile_rows,
+        .engine = engine,
+        .context = noise_context,
+        .use_depth = use_depth,
+        .depth = depth,
+        .depth_step = depth_step,
+        .octaves = octaves,
+        .per = per,
+        .bfreq = bfreq,
+        .bamp = bamp,
+        .format = format,
+        .sample_size = sample_size,
+        .noise = noise,
+        .scratch = scratch,
+        .writer = writer,
+        .tile_size = tile_size,
+        .tiles = tiles,
+        .chunks = chunks,
+    };
+
+    if (mapped && writer) {
+        job.mapped = tiff_writer_mapped_data(writer);
+        job.noise = job.mapped;
+    }
+
+    int* tiles_done = (int*) calloc((size_t) threads, sizeof(int));
+
+    // Tiles are numbered across pages, so with small pages every worker
+    // starts out with whole pages of its own
+    if (tile_size > 0 && !compressed && !failed) {
+        job.tiles_x = (width + tile_size - 1) / tile_size;
+        job.page_tiles = tiff_writer_tiles(writer);
+        pool_run(pool, (int) (job.page_tiles * pages), render_tiff_tile, &job);
+
+        for (int i = 0; tiles_done && i < threads; i++) {
+            tiles_done[i] += pool_worker_tasks(pool, i);
+        }
+    }
+
+    if (tile_size > 0 && compressed && !failed) {
+        job.tiles_x = (width + tile_size - 1) / tile_size;
+        job.page_tiles = tiff_writer_tiles(writer);
+        size_t total = job.page_tiles * pages;
+
+        for (size_t base = 0; base < total && !failed; base += (size_t) batch) {
+            int count = total - base < (size_t) batch ? (int) (total - base) : batch;
+            job.chunk_base = base;
+            pool_run(pool, count, encode_tiff_tile, &job);
+
+            for (int i = 0; tiles_done && i < threads; i++) {
+                tiles_done[i] += pool_worker_tasks(pool, i);
+            }
+
+            failed = append_chunks(&job, count) < 0;
+        }
+    }
+
+    for (size_t first = 0; first < total_tile_rows && tile_size == 0 && !failed; first += band_tiles_y) {
+        size_t tiles_y = total_tile_rows - first < band_tiles_y ? total_tile_rows - first : band_tiles_y;
+        job.band_first = first;
+        job.band_y = tile_row_start(&job, first);
+        int band_height = (int) (tile_row_start(&job, first + tiles_y) - job.band_y);
+
+        pool_run(pool, tiles_x * (int) tiles_y, render_tile, &job);
+
+        for (int i = 0; tiles_done && i < threads; i++) {
+            tiles_done[i] += pool_worker_tasks(pool, i);
+        }
+
+        if (mapped) {
+            // Already in the file
+        } else if (compressed) {
+            job.chunk_base = first;
+            pool_run(pool, (int) tiles_y, encode_strip, &job);
+            failed = append_chunks(&job, (int) tiles_y) < 0;
+        } else {
+            failed = tiff_writer_write_rows(writer, noise, band_height) < 0;
+        }
+    }
+
+    if (writer && tiff_writer_close(writer) < 0) {
+        failed = 1;
+    }
+
+    if (verbose && tiles_done) {
+        for (int i = 0; i < threads; i++) {
+            fprintf(stderr, "thread %d: %d tiles\n", i, tiles_done[i]);
+        }
+    }
+
+    free(tiles_done);
+    for (int i = 0; scratch && tiles && i < threads; i++) {
+        free(scratch[i]);
+        free(tiles[i]);
+    }
+    for (int i = 0; chunks && i < batch; i++) {
+        tiff_chunk_free(&chunks[i]);
+    }
+    free(chunks);
+    free(scratch);
+    free(tiles);
     free(noise);
-    return EXIT_SUCCESS;
+    pool_destroy(pool);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,121 @@
+#include "noise.h"
+
+#include <string.h>
+
+#include "iperlin.h"
+#include "simplex.h"
+
+int noise_engine_parse(const char* name, enum noise_engine* engine) {
+    if (strcmp(name, "perlin") == 0) {
+        *engine = NOISE_ENGINE_PERLIN;
+    } else if (strcmp(name, "simplex") == 0) {
+        *engine = NOISE_ENGINE_SIMPLEX;
+    } else if (strcmp(name, "hashed") == 0) {
+        *engine = NOISE_ENGINE_HASHED;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char* noise_engine_name(enum noise_engine engine) {
+    switch (engine) {
+    case NOISE_ENGINE_SIMPLEX:
+        return "simplex";
+    case NOISE_ENGINE_HASHED:
+        return "hashed";
+    default:
+        return "perlin";
+    }
+}
+
+enum noise_engine noise_engine_next(enum noise_engine engine) {
+    switch (engine) {
+    case NOISE_ENGINE_PERLIN:
+        return NOISE_ENGINE_SIMPLEX;
+    case NOISE_ENGINE_SIMPLEX:
+        return NOISE_ENGINE_HASHED;
+    default:
+        return NOISE_ENGINE_PERLIN;
+    }
+}
+
+void noise_fill_grid(enum noise_engine engine, const struct noyc_context* context,
+                     double ox, double oy, double oz, double dx, double dy,
+                     int width, int height, int octaves, double persistence, double bfreq, double bamp, double* out) {
+    switch (engine) {
+    case NOISE_ENGINE_SIMPLEX:
+        simplex_ctx_fill_grid(context, ox, oy, oz, dx, dy, width, height, octaves, persistence, bfreq, bamp, out);
+        break;
+    case NOISE_ENGINE_HASHED:
+        iperlin_hash_fill_grid(context, ox, oy, oz, dx, dy, width, height, octaves, persistence, bfreq, bamp, out);
+        break;
+    default:
+        iperlin_ctx_fill_grid(context, ox, oy, oz, dx, dy, width, height, octaves, persistence, bfreq, bamp, out);
+        break;
+    }
+}
+
+void noise2_fill_grid(enum noise_engine engine, const struct noyc_context* context,
+                      double ox, double oy, double dx, double dy,
+                      int width, int height, int octaves, double persistence, double bfreq, double bamp, double* out) {
+    switch (engine) {
+    case NOISE_ENGINE_SIMPLEX:
+        simplex2_ctx_fill_grid(context, ox, oy, dx, dy, width, height, octaves, persistence, bfreq, bamp, out);
+        break;
+    case NOISE_ENGINE_HASHED:
+        iperlin2_hash_fill_grid(context, ox, oy, dx, dy, width, height, octaves, persistence, bfreq, bamp, out);
+        break;
+    default:
+        iperlin2_ctx_fill_grid(context, ox, oy, dx, dy, width, height, octaves, persistence, bfreq, bamp, out);
+        break;
+    }
+}
+
+void noise_fill_layers(enum noise_engine engine, const struct noyc_context* context,
+                       double ox, double oy, double oz, double dx, double dy,
+                       int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride) {
+    switch (engine) {
+    case NOISE_ENGINE_SIMPLEX:
+        simplex_ctx_fill_layers(context, ox, oy, oz, dx, dy, width, height, octaves, bfreq, layers, layer_stride);
+        break;
+    case NOISE_ENGINE_HASHED:
+        iperlin_hash_fill_layers(context, ox, oy, oz, dx, dy, width, height, octaves, bfreq, layers, layer_stride);
+        break;
+    default:
+        iperlin_ctx_fill_layers(context, ox, oy, oz, dx, dy, width, height, octaves, bfreq, layers, layer_stride);
+        break;
+    }
+}
+
+void noise4_fill_grid(enum noise_engine engine, const struct noyc_context* context,
+                      double ox, double oy, double oz, double ow, double dx, double dy,
+                      int width, int height, int octaves, double persistence, double bfreq, double bamp, double* out) {
+    switch (engine) {
+    case NOISE_ENGINE_SIMPLEX:
+        simplex4_ctx_fill_grid(context, ox, oy, oz, ow, dx, dy, width, height, octaves, persistence, bfreq, bamp, out);
+        break;
+    case NOISE_ENGINE_HASHED:
+        iperlin4_hash_fill_grid(context, ox, oy, oz, ow, dx, dy, width, height, octaves, persistence, bfreq, bamp, out);
+        break;
+    default:
+        iperlin4_ctx_fill_grid(context, ox, oy, oz, ow, dx, dy, width, height, octaves, persistence, bfreq, bamp, out);
+        break;
+    }
+}
+
+void noise4_fill_layers(enum noise_engine engine, const struct noyc_context* context,
+                        double ox, double oy, double oz, double ow, double dx, double dy,
+                        int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride) {
+    switch (engine) {
+    case NOISE_ENGINE_SIMPLEX:
+        simplex4_ctx_fill_layers(context, ox, oy, oz, ow, dx, dy, width, height, octaves, bfreq, layers, layer_stride);
+        break;
+    case NOISE_ENGINE_HASHED:
+        iperlin4_hash_fill_layers(context, ox, oy, oz, ow, dx, dy, width, height, octaves, bfreq, layers, layer_stride);
+        break;
+    default:
+        iperlin4_ctx_fill_layers(context, ox, oy, oz, ow, dx, dy, width, height, octaves, bfreq, layers, layer_stride);
+        break;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef NOISE_H_
+#define NOISE_H_
+
+#include <stddef.h>
+
+#include "context.h"
+
+/*
+** Noise engine selection
+**
+** Hosts keep an engine and a noise context next to their noise parameters
+** and go through these to reach the grid functions of iperlin.h or
+** simplex.h. Values of all engines lie in about [-1, 1] and share the
+** octave layer layout, so layers of any engine are recombined with
+** iperlin_combine_layers.
+*/
+
+enum noise_engine {
+    NOISE_ENGINE_PERLIN,
+    NOISE_ENGINE_SIMPLEX,
+    // Improved Perlin noise on the hashed lattice of the context seed
+    NOISE_ENGINE_HASHED,
+};
+
+// Parses "perlin", "simplex" or "hashed", returns -1 for anything else
+int noise_engine_parse(const char* name, enum noise_engine* engine);
+const char* noise_engine_name(enum noise_engine engine);
+// The engine after engine, wrapping around, for hosts that cycle through them
+enum noise_engine noise_engine_next(enum noise_engine engine);
+
+void noise_fill_grid(enum noise_engine engine, const struct noyc_context* context,
+                     double ox, double oy, double oz, double dx, double dy,
+                     int width, int height, int octaves, double persistence, double bfreq, double bamp, double* out);
+void noise2_fill_grid(enum noise_engine engine, const struct noyc_context* context,
+                      double ox, double oy, double dx, double dy,
+                      int width, int height, int octaves, double persistence, double bfreq, double bamp, double* out);
+void noise_fill_layers(enum noise_engine engine, const struct noyc_context* context,
+                       double ox, double oy, double oz, double dx, double dy,
+                       int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride);
+
+// 4D grids and layers in the plane at (oz, ow)
+void noise4_fill_grid(enum noise_engine engine, const struct noyc_context* context,
+                      double ox, double oy, double oz, double ow, double dx, double dy,
+                      int width, int height, int octaves, double persistence, double bfreq, double bamp, double* out);
+void noise4_fill_layers(enum noise_engine engine, const struct noyc_context* context,
+                        double ox, double oy, double oz, double ow, double dx, double dy,
+                        int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride);
+
+#endif // NOISE_H_
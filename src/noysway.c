@@ -1,121 +1,143 @@
 #include <wayland-client-protocol.h>
 #include <wayland-client.h>
 #include <wayland-util.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <sys/mman.h>
+#include <unistd.h>
 
-#include "wayland/xdg-shell-protocol.h"
-
-#include "sharedmem.h"
-#include "iperlin.h"
+#include "wayland/wayland.h"
 
 #define DEFAULT_NOISE_OCTAVES 8;
 #define DEFAULT_NOISE_PER 0.75;
 #define DEFAULT_NOISE_BASE_FREQ 0.00095;
 #define DEFAULT_NOISE_BASE_AMP 0.5;
 
-// Pixel noise state
-struct noise_state {
-    int octaves;
-    double per;
-    double bfreq;
-    double bamp;
-};
-
-// Overwrites
-void generate_noise(int width, int height, double depth, struct noise_state* noise, uint32_t* pixels) {
- for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            size_t index = (size_t)(y*width + x);
-            double n_v = octave_iperlin_at(
-                (double) x, (double) y, depth,
-                noise->octaves,
-                noise->per,
-                noise->bfreq,
-                noise->bamp);
-            uint8_t val = (uint8_t)((n_v * 0.5 + 0.5) * 255.0);
-            uint8_t construct[] = {val, val, val, 255};
-            uint32_t pixel = *((uint32_t*)&construct);
-            pixels[index] = pixel;
-        }
-    }
+// One on screen, one queued and one to draw into
+#define FRAME_BUFFERS 3
 
-}
+// Time between noise slices
+#define UPDATE_INTERVAL_MS 100
 
-// Our applciation state
-struct app_state {
-    // Wayland
-    struct wl_display* display;
-    struct wl_registry* registry;
-    struct wl_compositor* compositor;
-    struct wl_surface* surface;
-
-    // Shared memory
-    struct wl_shm* shm;
-
-    //XDG structures
-    struct xdg_wm_base* xdg_wm_base;
-    struct xdg_surface *xdg_surface;
-    struct xdg_toplevel *xdg_toplevel;
-
-    // runtime params
-    int closed;
-    int regenerate;
-    int width;
-    int height;
-    double depth;
+static const struct wl_callback_listener wl_surface_frame_listener;
 
-    uint32_t elapsed;
-    uint32_t last_frame;
+static void present_buffer(struct app_state* app, struct pool_buffer* buffer) {
+    if (app->viewport) {
+        // Reduced frames only cover the top left of the buffer
+        wp_viewport_set_source(app->viewport, 0, 0,
+                               wl_fixed_from_int(buffer->content_width), wl_fixed_from_int(buffer->content_height));
+        wp_viewport_set_destination(app->viewport, buffer->pool->width, buffer->pool->height);
+    }
 
-    struct noise_state noise;
+    wl_surface_attach(app->surface, buffer->buffer, 0, 0);
+    wl_surface_damage_buffer(app->surface, 0, 0, INT32_MAX, INT32_MAX);
 
-    // pixels in 0xRRGGBBAA format
-    uint32_t* pixels;
-};
+    // Frames that finish before this one is shown replace each other
+    struct wl_callback* cb = wl_surface_frame(app->surface);
+    wl_callback_add_listener(cb, &wl_surface_frame_listener, app);
+    app->frame_pending = 1;
 
+    wl_surface_commit(app->surface);
 
-// Buffer cleanup
-static void wl_buffer_release(void* data, struct wl_buffer* buffer) {
-    wl_buffer_destroy(buffer);
+    // The shown buffer stays readable for resize previews until the next
+    // one replaces it, even once the compositor is done with it
+    if (app->shown) {
+        buffer_pool_unpin(app->shown);
+    }
+    buffer_pool_pin(buffer);
+    app->shown = buffer;
 }
 
-static const struct wl_buffer_listener buffer_listener = {
-.release = wl_buffer_release
-};
+/// Attaches the newest frame of the render thread, if there is one and
+// the compositor is ready for it. Returns 0 when nothing was committed.
+static int draw_frame(struct app_state* app) {
+    if (!app->configured || app->frame_pending) {
+        return 0;
+    }
 
-/// Drawing will require utilising and copying to a shared memory
-// area
-static struct wl_buffer* draw_frame(struct app_state* app) {
-    int stride = app->width * 4; // uint32_t is 4 bytes
-    int size = app->height * stride;
-
-    int fd = allocate_shm_file(size); // allocate shared memory
-    uint32_t* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (data == MAP_FAILED) {
-        close(fd);
-        return NULL;
+    struct pool_buffer* buffer = renderer_take_frame(&app->renderer);
+    if (!buffer) {
+        return 0;
+    }
+    if (buffer->pool != app->buffers) {
+        // Rendered before the last resize
+        buffer_pool_release(buffer);
+        return 0;
     }
 
-    struct wl_shm_pool* pool = wl_shm_create_pool(app->shm, fd, size);
-    int index = 0; // When data is stored in a single buffer, this could be used as the index
-    int offset = app->height * stride * index;
-    struct wl_buffer* buffer = wl_shm_pool_create_buffer(pool, offset, app->width, app->height, stride, WL_SHM_FORMAT_XRGB8888);
+    present_buffer(app, buffer);
+    return 1;
+}
 
-    wl_shm_pool_destroy(pool);
-    close(fd);
+// Nearest neighbour copy of the image in src stretched over all of dst
+static void scale_frame(const struct pool_buffer* src, struct pool_buffer* dst) {
+    int src_width = src->content_width;
+    int src_height = src->content_height;
+    int src_stride = src->pool->width;
+    int dst_width = dst->pool->width;
+    int dst_height = dst->pool->height;
+
+    // 16.16 fixed point steps through the source
+    uint32_t step_x = (uint32_t) (((uint64_t) src_width << 16) / dst_width);
+    uint32_t step_y = (uint32_t) (((uint64_t) src_height << 16) / dst_height);
+
+    uint32_t sy = 0;
+    for (int y = 0; y < dst_height; ++y, sy += step_y) {
+        const uint32_t* src_row = src->pixels + (size_t) (sy >> 16) * src_stride;
+        uint32_t* dst_row = dst->pixels + (size_t) y * dst_width;
+
+        uint32_t sx = 0;
+        for (int x = 0; x < dst_width; ++x, sx += step_x) {
+            dst_row[x] = src_row[sx >> 16];
+        }
+    }
+}
 
-    uint32_t* pixels = (uint32_t*) &data[offset];
-    memcpy(pixels, app->pixels, size);
+/// Swaps in buffers of the configured size. The last frame is stretched
+/// into the first new buffer and shown at once, the render thread follows
+/// with a full render at the new size.
+static void resize_buffers(struct app_state* app) {
+    struct buffer_pool* buffers = buffer_pool_create(app->shm, app->width, app->height, FRAME_BUFFERS);
+    if (!buffers) {
+        fprintf(stderr, "Failed to resize frame buffers to %dx%d\n", app->width, app->height);
+        app->width = app->buffers->width;
+        app->height = app->buffers->height;
+        wl_surface_commit(app->surface);
+        return;
+    }
 
-    munmap(data, size);
+    struct pool_buffer* preview = buffer_pool_acquire(buffers);
+    preview->content_width = buffers->width;
+    preview->content_height = buffers->height;
+    if (app->shown) {
+        scale_frame(app->shown, preview);
+    } else {
+        memset(preview->pixels, 0, (size_t) buffers->stride * buffers->height);
+    }
+    present_buffer(app, preview);
 
-    // We can now add a listener for this particular draw buffer udpates
-    wl_buffer_add_listener(buffer, &buffer_listener, NULL);
+    // A pool from an earlier resize the render thread never started on
+    struct buffer_pool* unused = renderer_set_buffers(&app->renderer, buffers);
+    if (unused) {
+        buffer_pool_destroy(unused);
+    }
+    app->buffers = buffers;
+}
 
-    return buffer;
+// Destroys pools the render thread has moved away from
+static void collect_buffers(struct app_state* app) {
+    struct buffer_pool* retired = renderer_take_retired(&app->renderer);
+    while (retired) {
+        struct buffer_pool* next = retired->next_retired;
+        if (app->shown && app->shown->pool == retired) {
+            app->shown = NULL;
+        }
+        buffer_pool_destroy(retired);
+        retired = next;
+    }
 }
 
 // Resizing
@@ -136,7 +158,9 @@ static void xdg_toplevel_close(void* data, struct xdg_toplevel* toplevel) {
     app->closed = 1;
 }
 
-static void xdg_toplevel_configure_bounds()
+static void xdg_toplevel_configure_bounds(void* data, struct xdg_toplevel* toplevel, int32_t width, int32_t height) {
+    // Bounds are only a hint, the size comes with configure
+}
 
 static const struct xdg_toplevel_listener xdg_toplevel_listener = {
 .configure = xdg_toplevel_configure,
@@ -149,9 +173,17 @@ static void xdg_surface_configure(void* data, struct xdg_surface* surface, uint3
     struct app_state* app = (struct app_state*) data;
     xdg_surface_ack_configure(surface, serial);
 
-    struct wl_buffer *buffer = draw_frame(app);
-    wl_surface_attach(app->surface, buffer, 0, 0);
-    wl_surface_commit(app->surface);
+    app->configured = 1;
+
+    if (app->width != app->buffers->width || app->height != app->buffers->height) {
+        resize_buffers(app);
+        return;
+    }
+
+    // Without a new frame the ack still has to be committed
+    if (!draw_frame(app)) {
+        wl_surface_commit(app->surface);
+    }
 }
 
 
@@ -170,34 +202,11 @@ static const struct xdg_wm_base_listener xdg_wm_base_listener = {
 };
 
 // Updating frames
-static const struct wl_callback_listener wl_surface_frame_listener;
-
 static void wl_surface_frame_done(void* data, struct wl_callback *cb, uint32_t time) {
     wl_callback_destroy(cb);
 
     struct app_state* app = (struct app_state*) data;
-    cb = wl_surface_frame(app->surface);
-    wl_callback_add_listener(cb, &wl_surface_frame_listener, app);
-
-    if (app->last_frame != 0) {
-        uint32_t elapsed = time - app->last_frame;
-        app->elapsed += elapsed;
-
-        if (app->elapsed > 100) {
-            app->depth += 1.0;
-            generate_noise(app->width, app->height, app->depth, &app->noise, app->pixels);
-            app->elapsed = 0;
-        }
-    }
-
-    // Submit a frame for this event
-    struct wl_buffer* buffer = draw_frame(app);
-    wl_surface_attach(app->surface, buffer, 0, 0);
-    wl_surface_damage_buffer(app->surface, 0, 0, INT32_MAX, INT32_MAX);
-    wl_surface_commit(app->surface);
-
-    // This is where delta time can be set
-    app->last_frame = time;
+    app->frame_pending = 0;
 }
 
 static const struct wl_callback_listener wl_surface_frame_listener = {
@@ -214,13 +223,17 @@ static void registry_handle_global(void *data, struct wl_registry* registry,
     } else if (strcmp(interface, wl_shm_interface.name) == 0) {
         app->shm = wl_registry_bind(
             registry, name, &wl_shm_interface, 2);
-    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
-        app->shm = wl_registry_bind(
-            registry, name, &wl_shm_interface, 2);
+    } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+        app->viewporter = wl_registry_bind(
+            registry, name, &wp_viewporter_interface, 1);
     } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
         app->xdg_wm_base = wl_registry_bind(
             registry, name, &xdg_wm_base_interface, 5);
         xdg_wm_base_add_listener(app->xdg_wm_base, &xdg_wm_base_listener, app);
+    } else if (strcmp(interface, wl_seat_interface.name) == 0) {
+        app->seat = wl_registry_bind(
+            registry, name, &wl_seat_interface, version < 7 ? version : 7);
+        wl_seat_add_listener(app->seat, &wl_seat_listener, app);
     }
 }
 
@@ -234,7 +247,111 @@ const struct wl_registry_listener registry_listener = {
 .global_remove = registry_handle_global_remove
 };
 
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "  -t, --threads N   render threads, 0 uses every core (default 0)\n");
+    fprintf(stderr, "      --engine E    perlin, simplex or hashed noise (default perlin)\n");
+    fprintf(stderr, "      --seed N      shuffle the permutation table and hash from seed N\n");
+    fprintf(stderr, "      --decorrelate cycle the octaves through 4 tables, one hash seed each\n");
+    fprintf(stderr, "      --budget MS   frame time the render resolution adapts to, 0 keeps\n");
+    fprintf(stderr, "                    full resolution (default %d)\n", UPDATE_INTERVAL_MS);
+    fprintf(stderr, "      --loop N      animate a seamless loop of N slices, each rendered\n");
+    fprintf(stderr, "                    once and replayed (default off)\n");
+}
+
+static int parse_int(const char* text, int* value) {
+    char* endptr;
+    errno = 0;
+    long parsed = strtol(text, &endptr, 10);
+    if (endptr == text || *endptr != '\0' || errno != 0 || parsed < 0 || parsed > INT32_MAX) {
+        fprintf(stderr, "Invalid number format: %s\n", text);
+        return -1;
+    }
+    *value = (int) parsed;
+    return 0;
+}
+
+static int parse_seed(const char* text, uint32_t* value) {
+    char* endptr;
+    errno = 0;
+    unsigned long long parsed = strtoull(text, &endptr, 10);
+    if (endptr == text || *endptr != '\0' || errno != 0 || text[0] == '-' || parsed > UINT32_MAX) {
+        fprintf(stderr, "Invalid seed: %s\n", text);
+        return -1;
+    }
+    *value = (uint32_t) parsed;
+    return 0;
+}
+
 int main(int argc, char** argv) {
+    enum noise_engine engine = NOISE_ENGINE_PERLIN;
+    int seeded = 0;
+    uint32_t seed = 0;
+    int decorrelate = 0;
+    // Lives as long as the renderer
+    struct noyc_context context;
+    struct render_options render = {
+        .threads = 0,
+        .interval_ms = UPDATE_INTERVAL_MS,
+        .budget_ms = UPDATE_INTERVAL_MS,
+    };
+
+    static const struct option options[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"engine", required_argument, NULL, 'E'},
+        {"seed", required_argument, NULL, 'R'},
+        {"decorrelate", no_argument, NULL, 'D'},
+        {"budget", required_argument, NULL, 'B'},
+        {"loop", required_argument, NULL, 'L'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:", options, NULL)) != -1) {
+        switch (opt) {
+        case 't':
+            if (parse_int(optarg, &render.threads) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'E':
+            if (noise_engine_parse(optarg, &engine) < 0) {
+                fprintf(stderr, "Unknown noise engine: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'R':
+            if (parse_seed(optarg, &seed) < 0) {
+                return EXIT_FAILURE;
+            }
+            seeded = 1;
+            break;
+        case 'D':
+            decorrelate = 1;
+            break;
+        case 'B':
+            if (parse_int(optarg, &render.budget_ms) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'L':
+            if (parse_int(optarg, &render.loop_frames) < 0) {
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (seeded || decorrelate) {
+        noyc_context_init(&context, seed, decorrelate);
+        render.context = &context;
+    }
 
     struct app_state app = {0};
     // Initialise the display
@@ -251,6 +368,13 @@ int main(int argc, char** argv) {
         return EXIT_FAILURE;
     }
 
+    // Keymaps arrive once the seat hands out a keyboard
+    app.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    if (!app.xkb_context) {
+        fprintf(stderr, "Failed to create xkb context\n");
+        return EXIT_FAILURE;
+    }
+
     // Setup or prepare the application
     wl_registry_add_listener(app.registry, &registry_listener, &app);
 
@@ -272,18 +396,38 @@ int main(int argc, char** argv) {
     noise.per = DEFAULT_NOISE_PER;
     noise.bfreq = DEFAULT_NOISE_BASE_FREQ;
     noise.bamp = DEFAULT_NOISE_BASE_AMP;
+    noise.engine = engine;
 
     app.closed = 0;
     app.width = 1024;
     app.height = 1024;
-    app.depth = 0.0;
-    app.elapsed = 0;
-    app.last_frame = 0;
-    app.noise = noise;
+    app.configured = 0;
+    app.frame_pending = 0;
 
-    app.pixels = malloc(sizeof(uint32_t) * app.width * app.height);
+    // Buffers live as long as the window, frames only pick a free one
+    app.buffers = buffer_pool_create(app.shm, app.width, app.height, FRAME_BUFFERS);
+    if (!app.buffers) {
+        fprintf(stderr, "Failed to create frame buffers\n");
+        return EXIT_FAILURE;
+    }
 
-    generate_noise(app.width, app.height, app.depth, &app.noise, app.pixels);
+    // Reduced resolution frames are scaled by the compositor when it can
+    if (app.viewporter) {
+        app.viewport = wp_viewporter_get_viewport(app.viewporter, app.surface);
+    }
+    render.upscale = app.viewport == NULL;
+
+    // Rendering runs on its own threads from here on
+    app.controls = (struct render_controls) {
+        .noise = noise,
+        .speed = 1.0,
+        .zoom = 1.0,
+    };
+    app.resume_speed = app.controls.speed;
+    app.controls_dirty = 0;
+    if (renderer_start(&app.renderer, app.buffers, &app.controls, &render) != 0) {
+        return EXIT_FAILURE;
+    }
 
     // we can now setup xdg surfaces and parts
     app.xdg_surface = xdg_wm_base_get_xdg_surface(app.xdg_wm_base, app.surface);
@@ -299,20 +443,72 @@ int main(int argc, char** argv) {
 
     // As xdg is setup, xdg_surface_configure will be called
     // from which the initial pixel can be drawn.
-    // After that, the pixels can be redrawn either every frame
-    // during the event loop or at another message based trigger
+    // After that the event loop attaches the newest slice of the
+    // render thread whenever the previous one has been shown
     wl_surface_commit(app.surface);
 
-    struct wl_callback* cb = wl_surface_frame(app.surface);
-    wl_callback_add_listener(cb, &wl_surface_frame_listener, &app);
+    // Sleeps until a Wayland event or a finished frame arrives, rendering
+    // never blocks this thread
+    struct pollfd fds[] = {
+        { .fd = wl_display_get_fd(app.display), .events = POLLIN },
+        { .fd = app.renderer.ready_fd, .events = POLLIN },
+    };
+    while (!app.closed) {
+        while (wl_display_prepare_read(app.display) != 0) {
+            wl_display_dispatch_pending(app.display);
+        }
+        wl_display_flush(app.display);
+
+        if (poll(fds, 2, -1) > 0 && (fds[0].revents & POLLIN)) {
+            if (wl_display_read_events(app.display) < 0) {
+                break;
+            }
+        } else {
+            wl_display_cancel_read(app.display);
+        }
+        if (wl_display_dispatch_pending(app.display) < 0) {
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            if (read(app.renderer.ready_fd, &count, sizeof(count)) < 0) {
+                perror("Could not read frame notification");
+            }
+        }
+        collect_buffers(&app);
+        draw_frame(&app);
+
+        // Input since the last shown frame goes out as one change, the
+        // renderer never queues more than a frame behind the pointer
+        if (app.controls_dirty && !app.frame_pending) {
+            renderer_set_controls(&app.renderer, &app.controls);
+            app.controls_dirty = 0;
+        }
+    }
 
-    // Possible event loop
-    while (wl_display_dispatch(app.display) && !app.closed) {
-        // iterate
+    renderer_stop(&app.renderer);
+    collect_buffers(&app);
+    // The render thread may have stopped before taking the last resize
+    struct buffer_pool* rendered = atomic_load(&app.renderer.buffers);
+    if (rendered != app.buffers) {
+        buffer_pool_destroy(rendered);
     }
+    buffer_pool_destroy(app.buffers);
 
+    if (app.pointer) {
+        wl_pointer_release(app.pointer);
+    }
+    if (app.keyboard) {
+        wl_keyboard_release(app.keyboard);
+    }
+    if (app.seat) {
+        wl_seat_release(app.seat);
+    }
+    xkb_state_unref(app.xkb_state);
+    xkb_keymap_unref(app.xkb_keymap);
+    xkb_context_unref(app.xkb_context);
     wl_display_disconnect(app.display);
-    free(app.pixels);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,230 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Each worker owns the task range [head, tail), packed into one word with the
+// head in the low 32 bits so the owner and thieves can race on it with CAS
+struct pool_worker {
+    _Alignas(64) _Atomic uint64_t range;
+    int tasks;
+    int index;
+    struct pool* pool;
+    pthread_t thread;
+};
+
+struct pool {
+    int threads;
+    struct pool_worker* workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finish;
+    unsigned long generation;
+    int running;
+    int quit;
+
+    pool_task_fn fn;
+    void* arg;
+};
+
+static inline uint64_t pack_range(uint32_t head, uint32_t tail) {
+    return ((uint64_t) tail << 32) | head;
+}
+
+static int pool_take(struct pool_worker* self, int* task) {
+    uint64_t range = atomic_load(&self->range);
+    for (;;) {
+        uint32_t head = (uint32_t) range;
+        uint32_t tail = (uint32_t) (range >> 32);
+        if (head >= tail) {
+            return 0;
+        }
+        if (atomic_compare_exchange_weak(&self->range, &range, pack_range(head + 1, tail))) {
+            *task = (int) head;
+            return 1;
+        }
+    }
+}
+
+// Moves the back half of the fullest other worker's range into ours
+static int pool_steal(struct pool* pool, struct pool_worker* self) {
+    for (;;) {
+        struct pool_worker* victim = NULL;
+        uint64_t victim_range = 0;
+        uint32_t most = 0;
+
+        for (int i = 0; i < pool->threads; i++) {
+            struct pool_worker* worker = &pool->workers[i];
+            if (worker == self) {
+                continue;
+            }
+            uint64_t range = atomic_load(&worker->range);
+            uint32_t head = (uint32_t) range;
+            uint32_t tail = (uint32_t) (range >> 32);
+            if (head < tail && tail - head > most) {
+                victim = worker;
+                victim_range = range;
+                most = tail - head;
+            }
+        }
+
+        if (!victim) {
+            return 0;
+        }
+
+        uint32_t head = (uint32_t) victim_range;
+        uint32_t tail = (uint32_t) (victim_range >> 32);
+        uint32_t mid = tail - (most + 1) / 2;
+        if (atomic_compare_exchange_strong(&victim->range, &victim_range, pack_range(head, mid))) {
+            // Our own range is empty, nobody can be stealing from it right now
+            atomic_store(&self->range, pack_range(mid, tail));
+            return 1;
+        }
+        // Lost a race with the owner or another thief, look again
+    }
+}
+
+static void pool_work(struct pool* pool, struct pool_worker* self) {
+    int task;
+    do {
+        while (pool_take(self, &task)) {
+            pool->fn(pool->arg, task, self->index);
+            self->tasks++;
+        }
+    } while (pool_steal(pool, self));
+}
+
+static void* pool_thread(void* data) {
+    struct pool_worker* self = (struct pool_worker*) data;
+    struct pool* pool = self->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->quit) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_work(pool, self);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->finish);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+struct pool* pool_create(int threads) {
+    if (threads <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (int) online : 1;
+    }
+
+    struct pool* pool = (struct pool*) calloc(1, sizeof(struct pool));
+    if (!pool) {
+        return NULL;
+    }
+
+    size_t size = sizeof(struct pool_worker) * threads;
+    pool->workers = (struct pool_worker*) aligned_alloc(_Alignof(struct pool_worker), size);
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+    memset(pool->workers, 0, size);
+
+    pool->threads = threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finish, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        pool->workers[i].index = i;
+        pool->workers[i].pool = pool;
+    }
+
+    // Worker 0 is whoever calls pool_run
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, pool_thread, &pool->workers[i]) != 0) {
+            pool->threads = i;
+            pool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void pool_destroy(struct pool* pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->threads; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&pool->finish);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+int pool_threads(const struct pool* pool) {
+    return pool->threads;
+}
+
+void pool_run(struct pool* pool, int count, pool_task_fn fn, void* arg) {
+    int threads = pool->threads;
+
+    for (int i = 0; i < threads; i++) {
+        uint32_t head = (uint32_t) ((long) count * i / threads);
+        uint32_t tail = (uint32_t) ((long) count * (i + 1) / threads);
+        atomic_store(&pool->workers[i].range, pack_range(head, tail));
+        pool->workers[i].tasks = 0;
+    }
+
+    if (count <= 0) {
+        return;
+    }
+
+    pool->fn = fn;
+    pool->arg = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running = threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_work(pool, &pool->workers[0]);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->finish, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int pool_worker_tasks(const struct pool* pool, int worker) {
+    return pool->workers[worker].tasks;
+}
@@ -0,0 +1,30 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+/*
+** Small work-stealing thread pool
+**
+** pool_run hands out tasks 0..count-1. Every worker starts with an even,
+** contiguous share of the task range and takes tasks from its front. A
+** worker that runs dry steals the back half of the fullest remaining share,
+** so uneven tasks still finish close together. The calling thread takes part
+** as worker 0.
+*/
+
+typedef void (*pool_task_fn)(void* arg, int task, int worker);
+
+struct pool;
+
+// threads <= 0 means one worker per online CPU. Returns NULL on failure.
+struct pool* pool_create(int threads);
+void pool_destroy(struct pool* pool);
+
+int pool_threads(const struct pool* pool);
+
+// Runs fn(arg, task, worker) for every task and returns once all are done
+void pool_run(struct pool* pool, int count, pool_task_fn fn, void* arg);
+
+// Number of tasks the worker executed during the last pool_run
+int pool_worker_tasks(const struct pool* pool, int worker);
+
+#endif // POOL_H_
@@ -0,0 +1,950 @@
+#include "renderer.h"
+
+#include <math.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iperlin.h"
+#include "pool.h"
+
+// Rows each task generates
+#define RENDER_BAND_ROWS 32
+
+// Generation time between checks for a resize or newer controls
+#define RENDER_STEP_NS 4000000
+
+// Render scale limits, and the share of the budget below which it grows
+#define RENDER_SCALE_MIN 0.125
+#define RENDER_SCALE_STEP_UP 1.25
+#define RENDER_HEADROOM 0.7
+
+// How a frame is drawn
+enum render_plan {
+    // Every pixel generated
+    RENDER_FULL,
+    // The cached octave layers recombined with new weights
+    RENDER_RECOMBINE,
+    // The last frame moved by whole pixels, only the exposed edges generated
+    RENDER_SHIFT,
+    // The last frame resampled and published first, then generated in full
+    RENDER_REFINE,
+    // A finished slice of the loop copied
+    RENDER_REPLAY,
+};
+
+// One frame being rendered, width x height samples spread over the buffer.
+// With layers set the octaves go through the layer cache, fill_layers
+// tells whether they are regenerated or only recombined.
+struct render_frame {
+    struct renderer* renderer;
+    const struct noise_state* noise;
+    float* layers;
+    size_t layer_stride;
+    int fill_layers;
+    uint32_t* pixels;
+    int stride;
+    int width;
+    int height;
+    double ox;
+    double oy;
+    double dx;
+    double dy;
+    // Slice position, w only counts for loop slices
+    double depth;
+    double ow;
+    // Slice of the loop, -1 when not looping
+    int loop_frame;
+    // Pixels the last frame moves by, for RENDER_SHIFT
+    int shift_x;
+    int shift_y;
+    // Set when newer controls make the frame worthless
+    int abortable;
+    // Part of the frame render_band generates
+    int x;
+    int y;
+    int rect_width;
+    int rect_height;
+};
+
+// A resize, shutdown or newer controls make the rest of the frame useless
+static int frame_outdated(struct renderer* renderer, const struct render_frame* frame) {
+    return atomic_load(&renderer->next_buffers) || atomic_load(&renderer->stop)
+        || (frame->abortable && atomic_load(&renderer->controls_changed));
+}
+
+// Stores rows x rect_width noise values from row y0 of the frame
+static void store_pixels(const struct render_frame* frame, int y0, int rows, const double* band) {
+    for (int y = 0; y < rows; ++y) {
+        const double* values = band + (size_t) y * frame->rect_width;
+        uint32_t* pixels = frame->pixels + (size_t) (y0 + y) * frame->stride + frame->x;
+
+        for (int x = 0; x < frame->rect_width; ++x) {
+            uint8_t val = (uint8_t)((values[x] * 0.5 + 0.5) * 255.0);
+            uint8_t construct[] = {val, val, val, 255};
+            pixels[x] = *((uint32_t*)&construct);
+        }
+    }
+}
+
+static void emit_band(void* arg, int y, int rows, const double* values, int worker) {
+    const struct render_frame* frame = (const struct render_frame*) arg;
+    store_pixels(frame, frame->y + y, rows, values);
+}
+
+// Layer frames go through the cache instead of the generator, they always
+// cover the whole frame
+static void render_band(void* arg, int task, int worker) {
+    struct render_frame* frame = (struct render_frame*) arg;
+    struct renderer* renderer = frame->renderer;
+    const struct noise_state* noise = frame->noise;
+    double* band = renderer->bands[worker];
+
+    if (frame_outdated(renderer, frame)) {
+        return;
+    }
+
+    int y0 = task * RENDER_BAND_ROWS;
+    int rows = frame->height - y0 < RENDER_BAND_ROWS ? frame->height - y0 : RENDER_BAND_ROWS;
+
+    float* layers = frame->layers + (size_t) y0 * frame->width;
+    if (frame->fill_layers && frame->loop_frame >= 0) {
+        noise4_fill_layers(noise->engine, renderer->context, frame->ox, frame->oy + y0 * frame->dy,
+            frame->depth, frame->ow, frame->dx, frame->dy, frame->width, rows, noise->octaves, noise->bfreq, layers, frame->layer_stride);
+    } else if (frame->fill_layers) {
+        noise_fill_layers(noise->engine, renderer->context, frame->ox, frame->oy + y0 * frame->dy, frame->depth,
+            frame->dx, frame->dy, frame->width, rows, noise->octaves, noise->bfreq, layers, frame->layer_stride);
+    }
+    iperlin_combine_layers(layers, frame->layer_stride, (size_t) frame->width * rows,
+        noise->octaves, noise->per, noise->bamp, band);
+
+    store_pixels(frame, y0, rows, band);
+}
+
+static int scaled_size(int size, double scale) {
+    int scaled = (int) (size * scale + 0.5);
+    return scaled < 1 ? 1 : scaled;
+}
+
+// Samples of the whole window at the frame's resolution
+static void frame_grid(const struct renderer* renderer, const struct buffer_pool* pool, struct render_frame* frame) {
+    frame->ox = renderer->controls.offset_x;
+    frame->oy = renderer->controls.offset_y;
+    frame->dx = renderer->controls.zoom * pool->width / frame->width;
+    frame->dy = renderer->controls.zoom * pool->height / frame->height;
+}
+
+static void render_rect(struct renderer* renderer, struct render_frame* frame, int x, int y, int width, int height) {
+    frame->x = x;
+    frame->y = y;
+    frame->rect_width = width;
+    frame->rect_height = height;
+
+    if (frame->layers) {
+        int bands = (height + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+        pool_run(renderer->workers, bands, render_band, frame);
+        return;
+    }
+
+    const struct noise_state* noise = frame->noise;
+    struct generator_grid grid = {
+        .engine = noise->engine,
+        .context = renderer->context,
+        .dimensions = frame->loop_frame >= 0 ? 4 : 3,
+        .ox = frame->ox + x * frame->dx,
+        .oy = frame->oy + y * frame->dy,
+        .oz = frame->depth,
+        .ow = frame->ow,
+        .dx = frame->dx,
+        .dy = frame->dy,
+        .width = width,
+        .height = height,
+        .octaves = noise->octaves,
+        .persistence = noise->per,
+        .bfreq = noise->bfreq,
+        .bamp = noise->bamp,
+    };
+    if (generator_begin(&renderer->generator, &grid, emit_band, frame) != 0) {
+        fprintf(stderr, "Could not allocate render bands for %dx%d\n", width, height);
+        atomic_store(&renderer->stop, 1);
+        return;
+    }
+
+    while (generator_step(&renderer->generator, RENDER_STEP_NS) == 0) {
+        if (frame_outdated(renderer, frame)) {
+            generator_cancel(&renderer->generator);
+        }
+    }
+}
+
+// Copies what stays in view of the last frame shift_x, shift_y pixels over
+// and generates the edges that came into view
+static void shift_frame(struct renderer* renderer, struct render_frame* frame) {
+    int width = frame->width;
+    int height = frame->height;
+    int kx = frame->shift_x;
+    int ky = frame->shift_y;
+
+    // Destination pixels that have a source in the last frame
+    int x0 = kx < 0 ? -kx : 0;
+    int x1 = kx > 0 ? width - kx : width;
+    int y0 = ky < 0 ? -ky : 0;
+    int y1 = ky > 0 ? height - ky : height;
+
+    for (int y = y0; y < y1; ++y) {
+        memcpy(frame->pixels + (size_t) y * frame->stride + x0,
+               renderer->history_pixels + (size_t) (y + ky) * width + x0 + kx,
+               sizeof(uint32_t) * (x1 - x0));
+    }
+
+    // Whole rows above or below the old frame, then the columns beside it
+    if (y0 > 0) {
+        render_rect(renderer, frame, 0, 0, width, y0);
+    }
+    if (y1 < height) {
+        render_rect(renderer, frame, 0, y1, width, height - y1);
+    }
+    if (x0 > 0) {
+        render_rect(renderer, frame, 0, y0, x0, y1 - y0);
+    }
+    if (x1 < width) {
+        render_rect(renderer, frame, x1, y0, width - x1, y1 - y0);
+    }
+}
+
+// Copies the finished loop slice of the frame
+static void replay_frame(struct renderer* renderer, struct render_frame* frame) {
+    size_t size = (size_t) frame->width * frame->height;
+    const uint32_t* slice = renderer->loop_pixels + size * frame->loop_frame;
+
+    for (int y = 0; y < frame->height; ++y) {
+        memcpy(frame->pixels + (size_t) y * frame->stride, slice + (size_t) y * frame->width,
+               sizeof(uint32_t) * frame->width);
+    }
+}
+
+// Fills the top left width x height pixels of the buffer with the noise of
+// the whole window, sampled at the reduced resolution
+static void generate_noise(struct renderer* renderer, struct pool_buffer* buffer, struct render_frame* frame,
+                           enum render_plan plan) {
+    frame->renderer = renderer;
+    frame->noise = &renderer->controls.noise;
+    frame->pixels = buffer->pixels;
+    frame->stride = buffer->pool->width;
+
+    if (plan == RENDER_REPLAY) {
+        replay_frame(renderer, frame);
+    } else if (plan == RENDER_SHIFT) {
+        shift_frame(renderer, frame);
+    } else {
+        render_rect(renderer, frame, 0, 0, frame->width, frame->height);
+    }
+}
+
+// Index of the sample nearest to at on a grid of count samples, clamped
+static int nearest_sample(double at, double origin, double step, int count) {
+    double i = round((at - origin) / step);
+    return i < 0.0 ? 0 : i >= count ? count - 1 : (int) i;
+}
+
+// Resamples the last exact frame onto the frame's grid, nearest neighbour.
+// Whatever lies outside of it repeats its edge.
+static void preview_frame(struct renderer* renderer, struct pool_buffer* buffer, const struct render_frame* frame) {
+    const struct frame_history* history = &renderer->history;
+    int* map = renderer->upscale_map;
+
+    for (int x = 0; x < frame->width; ++x) {
+        map[x] = nearest_sample(frame->ox + x * frame->dx, history->ox, history->dx, history->width);
+    }
+
+    for (int y = 0; y < frame->height; ++y) {
+        int sy = nearest_sample(frame->oy + y * frame->dy, history->oy, history->dy, history->height);
+        const uint32_t* src = renderer->history_pixels + (size_t) sy * history->width;
+        uint32_t* dst = buffer->pixels + (size_t) y * buffer->pool->width;
+
+        for (int x = 0; x < frame->width; ++x) {
+            dst[x] = src[map[x]];
+        }
+    }
+}
+
+// Keeps the frame as the source of the next shift or preview
+static void keep_history(struct renderer* renderer, const struct pool_buffer* buffer, const struct render_frame* frame) {
+    size_t size = (size_t) frame->width * frame->height;
+    if (size > renderer->history_capacity) {
+        uint32_t* pixels = (uint32_t*) realloc(renderer->history_pixels, sizeof(uint32_t) * size);
+        if (!pixels) {
+            renderer->history.valid = 0;
+            return;
+        }
+        renderer->history_pixels = pixels;
+        renderer->history_capacity = size;
+    }
+
+    for (int y = 0; y < frame->height; ++y) {
+        memcpy(renderer->history_pixels + (size_t) y * frame->width,
+               buffer->pixels + (size_t) y * buffer->pool->width,
+               sizeof(uint32_t) * frame->width);
+    }
+
+    renderer->history = (struct frame_history) {
+        .valid = 1,
+        .pool = buffer->pool,
+        .width = frame->width,
+        .height = frame->height,
+        .ox = frame->ox,
+        .oy = frame->oy,
+        .dx = frame->dx,
+        .dy = frame->dy,
+        .zoom = renderer->controls.zoom,
+        .depth = frame->depth,
+        .ow = frame->ow,
+        .noise = *frame->noise,
+    };
+}
+
+// Room for every octave layer of a width x height frame
+static int reserve_layers(struct renderer* renderer, int octaves, int width, int height) {
+    size_t size = (size_t) octaves * width * height;
+    if (size <= renderer->layers_capacity) {
+        return 0;
+    }
+
+    float* layers = (float*) realloc(renderer->layers, sizeof(float) * size);
+    if (!layers) {
+        return -1;
+    }
+    renderer->layers = layers;
+    renderer->layers_capacity = size;
+    return 0;
+}
+
+// The cached layers hold the octaves the next frame needs, only the
+// weights differ. The size is checked too, a pool of another size may
+// reuse the address of the one they were generated for.
+static int layers_match(const struct renderer* renderer, const struct buffer_pool* pool,
+                        const struct render_frame* frame) {
+    const struct layer_cache* cache = &renderer->cached;
+    return cache->valid
+        && cache->pool == pool
+        && cache->width == scaled_size(pool->width, renderer->scale)
+        && cache->height == scaled_size(pool->height, renderer->scale)
+        && cache->engine == renderer->controls.noise.engine
+        && cache->octaves == renderer->controls.noise.octaves
+        && cache->bfreq == renderer->controls.noise.bfreq
+        && cache->depth == frame->depth
+        && cache->ow == frame->ow
+        && cache->offset_x == renderer->controls.offset_x
+        && cache->offset_y == renderer->controls.offset_y
+        && cache->zoom == renderer->controls.zoom;
+}
+
+static int noise_equal(const struct noise_state* a, const struct noise_state* b) {
+    return a->engine == b->engine && a->octaves == b->octaves && a->per == b->per && a->bfreq == b->bfreq && a->bamp == b->bamp;
+}
+
+// The last exact frame holds the frame's samples, some of them moved by
+// whole pixels. The frame is snapped onto the old grid, which keeps it
+// within half a pixel of the requested offset.
+static int shift_history(const struct renderer* renderer, const struct buffer_pool* pool, struct render_frame* frame) {
+    const struct frame_history* history = &renderer->history;
+    if (!history->valid
+        || history->pool != pool
+        || history->width != frame->width
+        || history->height != frame->height
+        || history->dx != frame->dx
+        || history->dy != frame->dy
+        || history->depth != frame->depth
+        || history->ow != frame->ow
+        || !noise_equal(&history->noise, &renderer->controls.noise)) {
+        return 0;
+    }
+
+    double kx = round((frame->ox - history->ox) / frame->dx);
+    double ky = round((frame->oy - history->oy) / frame->dy);
+    if (fabs(kx) >= frame->width || fabs(ky) >= frame->height) {
+        return 0;
+    }
+
+    frame->ox = history->ox + kx * frame->dx;
+    frame->oy = history->oy + ky * frame->dy;
+    frame->shift_x = (int) kx;
+    frame->shift_y = (int) ky;
+    return 1;
+}
+
+// Loop slices were kept for the current controls. A pool of another size
+// may reuse the address of the one they were kept for, so they must also
+// still fit its buffers.
+static int loop_match(const struct renderer* renderer, const struct buffer_pool* pool) {
+    const struct loop_cache* loop = &renderer->loop;
+    return loop->valid
+        && loop->pool == pool
+        && loop->width <= pool->width
+        && loop->height <= pool->height
+        && loop->offset_x == renderer->controls.offset_x
+        && loop->offset_y == renderer->controls.offset_y
+        && loop->zoom == renderer->controls.zoom
+        && noise_equal(&loop->noise, &renderer->controls.noise);
+}
+
+// Keeps a finished loop slice for replay, slices of other controls are
+// dropped first. Without memory for the whole loop every slice is
+// generated from then on.
+static void keep_loop_frame(struct renderer* renderer, const struct pool_buffer* buffer,
+                            const struct render_frame* frame) {
+    struct loop_cache* loop = &renderer->loop;
+    size_t size = (size_t) frame->width * frame->height;
+
+    if (!loop_match(renderer, buffer->pool)) {
+        size_t capacity = size * renderer->loop_frames;
+        if (capacity > renderer->loop_capacity) {
+            uint32_t* pixels = (uint32_t*) realloc(renderer->loop_pixels, sizeof(uint32_t) * capacity);
+            if (!pixels) {
+                fprintf(stderr, "Could not keep %d loop slices of %dx%d, generating every slice\n",
+                    renderer->loop_frames, frame->width, frame->height);
+                free(renderer->loop_done);
+                renderer->loop_done = NULL;
+                loop->valid = 0;
+                return;
+            }
+            renderer->loop_pixels = pixels;
+            renderer->loop_capacity = capacity;
+        }
+
+        memset(renderer->loop_done, 0, renderer->loop_frames);
+        *loop = (struct loop_cache) {
+            .valid = 1,
+            .pool = buffer->pool,
+            .width = frame->width,
+            .height = frame->height,
+            .ox = frame->ox,
+            .oy = frame->oy,
+            .dx = frame->dx,
+            .dy = frame->dy,
+            .offset_x = renderer->controls.offset_x,
+            .offset_y = renderer->controls.offset_y,
+            .zoom = renderer->controls.zoom,
+            .noise = *frame->noise,
+        };
+    }
+
+    uint32_t* slice = renderer->loop_pixels + size * frame->loop_frame;
+    for (int y = 0; y < frame->height; ++y) {
+        memcpy(slice + (size_t) y * frame->width, buffer->pixels + (size_t) y * buffer->pool->width,
+               sizeof(uint32_t) * frame->width);
+    }
+    renderer->loop_done[frame->loop_frame] = 1;
+}
+
+// Places the slice of the current depth. A loop walks a circle through z
+// and w whose slices lie one unit apart, like those of the default speed.
+static void slice_position(const struct renderer* renderer, struct render_frame* frame) {
+    int frames = renderer->loop_frames;
+    if (frames <= 0) {
+        frame->depth = renderer->depth;
+        frame->ow = 0.0;
+        frame->loop_frame = -1;
+        return;
+    }
+
+    frame->loop_frame = (int) floor(renderer->depth) % frames;
+    double radius = frames / (2.0 * M_PI);
+    double angle = 2.0 * M_PI * frame->loop_frame / frames;
+    frame->depth = radius * cos(angle);
+    frame->ow = radius * sin(angle);
+}
+
+// Decides how the frame is drawn and lays out its grid
+static enum render_plan plan_frame(struct renderer* renderer, struct pool_buffer* buffer, struct render_frame* frame) {
+    struct buffer_pool* pool = buffer->pool;
+    const struct noise_state* noise = &renderer->controls.noise;
+
+    frame->layers = NULL;
+    frame->fill_layers = 0;
+    frame->abortable = 0;
+    slice_position(renderer, frame);
+
+    // Every slice of a loop is sampled on the grid of the first one
+    if (frame->loop_frame >= 0 && loop_match(renderer, pool)) {
+        const struct loop_cache* loop = &renderer->loop;
+        frame->width = loop->width;
+        frame->height = loop->height;
+        frame->ox = loop->ox;
+        frame->oy = loop->oy;
+        frame->dx = loop->dx;
+        frame->dy = loop->dy;
+        return renderer->loop_done[frame->loop_frame] ? RENDER_REPLAY : RENDER_FULL;
+    }
+
+    // A held slice is what gets tuned, its layers are worth keeping
+    if (renderer->controls.speed == 0.0 && layers_match(renderer, pool, frame)) {
+        frame->width = renderer->cached.width;
+        frame->height = renderer->cached.height;
+        frame->layers = renderer->layers;
+        frame->layer_stride = (size_t) frame->width * frame->height;
+        frame_grid(renderer, pool, frame);
+        return RENDER_RECOMBINE;
+    }
+
+    renderer->cached.valid = 0;
+    frame->width = scaled_size(pool->width, renderer->scale);
+    frame->height = scaled_size(pool->height, renderer->scale);
+    frame_grid(renderer, pool, frame);
+
+    if (shift_history(renderer, pool, frame)) {
+        return RENDER_SHIFT;
+    }
+
+    if (renderer->controls.speed == 0.0
+        && reserve_layers(renderer, noise->octaves, frame->width, frame->height) == 0) {
+        frame->layers = renderer->layers;
+        frame->layer_stride = (size_t) frame->width * frame->height;
+        frame->fill_layers = 1;
+    }
+
+    // A zoom is shown stretched until the exact frame is done, and the
+    // next zoom step need not wait for it
+    if (renderer->history.valid && renderer->history.zoom != renderer->controls.zoom) {
+        frame->abortable = 1;
+        return RENDER_REFINE;
+    }
+    return RENDER_FULL;
+}
+
+// Nearest neighbour stretch of the top left width x height pixels over the
+// whole buffer. Every source pixel lies at or before the pixels it fills,
+// so walking backwards never reads an overwritten one.
+static void upscale_frame(struct renderer* renderer, struct pool_buffer* buffer, int width, int height) {
+    int full_width = buffer->pool->width;
+    int full_height = buffer->pool->height;
+
+    for (int x = 0; x < full_width; ++x) {
+        renderer->upscale_map[x] = (int) ((int64_t) x * width / full_width);
+    }
+
+    for (int y = full_height - 1; y >= 0; --y) {
+        const uint32_t* src = buffer->pixels + (size_t) ((int64_t) y * height / full_height) * full_width;
+        uint32_t* dst = buffer->pixels + (size_t) y * full_width;
+
+        for (int x = full_width - 1; x >= 0; --x) {
+            dst[x] = src[renderer->upscale_map[x]];
+        }
+    }
+}
+
+// Without a compositor side viewport a reduced frame is stretched here
+static void finish_frame(struct renderer* renderer, struct pool_buffer* buffer, int width, int height) {
+    struct buffer_pool* pool = buffer->pool;
+    if (renderer->upscale && (width < pool->width || height < pool->height)) {
+        upscale_frame(renderer, buffer, width, height);
+        width = pool->width;
+        height = pool->height;
+    }
+    buffer->content_width = width;
+    buffer->content_height = height;
+}
+
+// Generation cost follows the pixel count, so the scale moves with the
+// square root of the budget over the measured time
+static void adjust_scale(struct renderer* renderer, double ms) {
+    if (renderer->budget_ms <= 0 || ms <= 0.0) {
+        return;
+    }
+
+    double ratio = sqrt(renderer->budget_ms / ms);
+    if (ms > renderer->budget_ms) {
+        // Aim a little under the budget so the next frame does not overshoot
+        renderer->scale *= ratio * 0.95;
+    } else if (ms < renderer->budget_ms * RENDER_HEADROOM) {
+        renderer->scale *= ratio < RENDER_SCALE_STEP_UP ? ratio : RENDER_SCALE_STEP_UP;
+    }
+
+    if (renderer->scale < RENDER_SCALE_MIN) {
+        renderer->scale = RENDER_SCALE_MIN;
+    }
+    if (renderer->scale > 1.0) {
+        renderer->scale = 1.0;
+    }
+}
+
+static void signal_ready(struct renderer* renderer) {
+    uint64_t one = 1;
+    if (write(renderer->ready_fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("Could not signal a new frame");
+    }
+}
+
+static void publish_frame(struct renderer* renderer, struct pool_buffer* buffer) {
+    struct pool_buffer* superseded = atomic_exchange(&renderer->ready, buffer);
+    if (superseded) {
+        buffer_pool_release(superseded);
+    }
+    signal_ready(renderer);
+}
+
+// Every worker band holds width samples per row
+static int reserve_bands(struct renderer* renderer, int width) {
+    if (width <= renderer->band_width) {
+        return 0;
+    }
+
+    for (int i = 0; i < pool_threads(renderer->workers); i++) {
+        double* band = (double*) realloc(renderer->bands[i], sizeof(double) * width * RENDER_BAND_ROWS);
+        if (!band) {
+            return -1;
+        }
+        renderer->bands[i] = band;
+    }
+
+    int* map = (int*) realloc(renderer->upscale_map, sizeof(int) * width);
+    if (!map) {
+        return -1;
+    }
+    renderer->upscale_map = map;
+    renderer->band_width = width;
+    return 0;
+}
+
+// Moves the render thread over to the pool of the latest resize
+static void switch_buffers(struct renderer* renderer, struct buffer_pool* next) {
+    struct buffer_pool* old = atomic_load(&renderer->buffers);
+
+    if (reserve_bands(renderer, next->width) != 0) {
+        fprintf(stderr, "Could not allocate render bands for %dx%d\n", next->width, next->height);
+        atomic_store(&renderer->stop, 1);
+    }
+
+    // An unshown frame of the old size is of no use anymore
+    struct pool_buffer* stale = atomic_exchange(&renderer->ready, NULL);
+    if (stale) {
+        buffer_pool_release(stale);
+    }
+
+    atomic_store(&renderer->buffers, next);
+    // Slices kept for the old pool are not replayed into the new one
+    renderer->loop.valid = 0;
+
+    old->next_retired = atomic_load(&renderer->retired);
+    while (!atomic_compare_exchange_weak(&renderer->retired, &old->next_retired, old)) {
+    }
+    signal_ready(renderer);
+}
+
+static void timespec_add_ms(struct timespec* ts, int ms) {
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long) (ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static double elapsed_ms(const struct timespec* from, const struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+static void signal_wake(struct renderer* renderer) {
+    uint64_t one = 1;
+    if (write(renderer->wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("Could not wake the render thread");
+    }
+}
+
+// Sleeps until timeout_ms pass or the renderer is woken, -1 waits for a wake
+static void wait_wake(struct renderer* renderer, int timeout_ms) {
+    struct pollfd fd = { .fd = renderer->wake_fd, .events = POLLIN };
+    if (poll(&fd, 1, timeout_ms) > 0) {
+        uint64_t count;
+        if (read(renderer->wake_fd, &count, sizeof(count)) < 0) {
+            perror("Could not read render wakeup");
+        }
+    }
+}
+
+// Copies controls set since the last frame, returns 1 when there were any
+static int take_controls(struct renderer* renderer) {
+    pthread_mutex_lock(&renderer->control_lock);
+    int changed = renderer->controls_changed;
+    if (changed) {
+        renderer->controls = renderer->pending_controls;
+        renderer->controls_changed = 0;
+    }
+    pthread_mutex_unlock(&renderer->control_lock);
+    return changed;
+}
+
+static void* render_main(void* arg) {
+    struct renderer* renderer = (struct renderer*) arg;
+
+    // Time the next slice is due
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    timespec_add_ms(&next, renderer->interval_ms);
+    int dirty = 1;
+
+    while (!atomic_load(&renderer->stop)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        int animating = renderer->controls.speed != 0.0;
+        double until_next = elapsed_ms(&now, &next);
+        if (!dirty && (!animating || until_next > 0.0)) {
+            // A held slice only changes on a wake, a running one also on time
+            wait_wake(renderer, animating ? (int) ceil(until_next) : -1);
+            dirty = take_controls(renderer) || atomic_load(&renderer->next_buffers) != NULL;
+            continue;
+        }
+
+        struct buffer_pool* next_buffers = atomic_exchange(&renderer->next_buffers, NULL);
+        if (next_buffers) {
+            switch_buffers(renderer, next_buffers);
+        }
+
+        if (!dirty) {
+            // Slow frames push the schedule back instead of bursting to catch up
+            renderer->depth += renderer->controls.speed;
+            if (renderer->loop_frames > 0) {
+                renderer->depth = fmod(renderer->depth, renderer->loop_frames);
+            }
+            timespec_add_ms(&next, renderer->interval_ms);
+            if (elapsed_ms(&now, &next) < 0.0) {
+                next = now;
+            }
+        }
+
+        // Waits for the compositor while it holds every other buffer
+        struct pool_buffer* buffer = buffer_pool_acquire_wait(atomic_load(&renderer->buffers));
+        if (!buffer) {
+            // The slice is already counted, it is rendered on the next try
+            dirty = 1;
+            continue;
+        }
+        take_controls(renderer);
+
+        struct render_frame frame;
+        enum render_plan plan = plan_frame(renderer, buffer, &frame);
+        struct buffer_pool* pool = buffer->pool;
+
+        if (plan == RENDER_REFINE) {
+            // Something to look at right away, the exact frame follows
+            preview_frame(renderer, buffer, &frame);
+            finish_frame(renderer, buffer, frame.width, frame.height);
+            publish_frame(renderer, buffer);
+
+            buffer = buffer_pool_acquire_wait(pool);
+            if (!buffer) {
+                dirty = 1;
+                continue;
+            }
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        generate_noise(renderer, buffer, &frame, plan);
+        if (frame_outdated(renderer, &frame)) {
+            // Abandoned half way, the next size or controls are rendered
+            // right away
+            buffer_pool_release(buffer);
+            renderer->cached.valid = 0;
+            dirty = 1;
+            continue;
+        }
+
+        if (frame.fill_layers) {
+            renderer->cached = (struct layer_cache) {
+                .valid = 1,
+                .pool = buffer->pool,
+                .width = frame.width,
+                .height = frame.height,
+                .engine = frame.noise->engine,
+                .octaves = frame.noise->octaves,
+                .bfreq = frame.noise->bfreq,
+                .depth = frame.depth,
+                .ow = frame.ow,
+                .offset_x = frame.ox,
+                .offset_y = frame.oy,
+                .zoom = renderer->controls.zoom,
+            };
+        }
+
+        keep_history(renderer, buffer, &frame);
+        if (frame.loop_frame >= 0 && renderer->loop_done && plan != RENDER_REPLAY) {
+            keep_loop_frame(renderer, buffer, &frame);
+        }
+        finish_frame(renderer, buffer, frame.width, frame.height);
+
+        // Recombined and shifted frames say nothing about what a full
+        // render costs
+        if (plan == RENDER_FULL || plan == RENDER_REFINE) {
+            struct timespec end;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            adjust_scale(renderer, elapsed_ms(&start, &end));
+        }
+
+        publish_frame(renderer, buffer);
+        dirty = 0;
+    }
+
+    return NULL;
+}
+
+int renderer_start(struct renderer* renderer, struct buffer_pool* buffers, const struct render_controls* controls,
+                   const struct render_options* options) {
+    atomic_init(&renderer->buffers, buffers);
+    atomic_init(&renderer->next_buffers, NULL);
+    atomic_init(&renderer->retired, NULL);
+    renderer->controls = *controls;
+    atomic_init(&renderer->controls_changed, 0);
+    renderer->depth = 0.0;
+    renderer->interval_ms = options->interval_ms;
+    renderer->budget_ms = options->budget_ms;
+    renderer->upscale = options->upscale;
+    renderer->context = options->context ? options->context : &noyc_default_context;
+    renderer->scale = 1.0;
+    renderer->bands = NULL;
+    renderer->band_width = 0;
+    renderer->generator.band_rows = NULL;
+    renderer->upscale_map = NULL;
+    renderer->layers = NULL;
+    renderer->layers_capacity = 0;
+    renderer->cached.valid = 0;
+    renderer->history_pixels = NULL;
+    renderer->history_capacity = 0;
+    renderer->history.valid = 0;
+    renderer->loop_frames = options->loop_frames > 0 ? options->loop_frames : 0;
+    renderer->loop_pixels = NULL;
+    renderer->loop_capacity = 0;
+    renderer->loop_done = NULL;
+    renderer->loop.valid = 0;
+    renderer->ready_fd = -1;
+    renderer->wake_fd = -1;
+    renderer->running = 0;
+    atomic_init(&renderer->stop, 0);
+    atomic_init(&renderer->ready, NULL);
+
+    renderer->workers = pool_create(options->threads);
+    if (!renderer->workers) {
+        fprintf(stderr, "Could not create render workers\n");
+        return -1;
+    }
+
+    renderer->bands = (double**) calloc(pool_threads(renderer->workers), sizeof(double*));
+    if (!renderer->bands || reserve_bands(renderer, buffers->width) != 0) {
+        fprintf(stderr, "Could not allocate render bands\n");
+        renderer_stop(renderer);
+        return -1;
+    }
+
+    if (renderer->loop_frames > 0) {
+        renderer->loop_done = (unsigned char*) calloc(renderer->loop_frames, 1);
+        if (!renderer->loop_done) {
+            fprintf(stderr, "Could not allocate %d loop slices\n", renderer->loop_frames);
+            renderer_stop(renderer);
+            return -1;
+        }
+    }
+
+    if (generator_init(&renderer->generator, renderer->workers) != 0) {
+        fprintf(stderr, "Could not set up the noise generator\n");
+        renderer_stop(renderer);
+        return -1;
+    }
+
+    pthread_mutex_init(&renderer->control_lock, NULL);
+
+    renderer->ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    renderer->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (renderer->ready_fd < 0 || renderer->wake_fd < 0) {
+        perror("Could not set up the renderer");
+        renderer_stop(renderer);
+        return -1;
+    }
+
+    if (pthread_create(&renderer->thread, NULL, render_main, renderer) != 0) {
+        fprintf(stderr, "Could not start the render thread\n");
+        renderer_stop(renderer);
+        return -1;
+    }
+    renderer->running = 1;
+
+    return 0;
+}
+
+void renderer_stop(struct renderer* renderer) {
+    if (renderer->running) {
+        atomic_store(&renderer->stop, 1);
+        signal_wake(renderer);
+        buffer_pool_wake(atomic_load(&renderer->buffers));
+        pthread_join(renderer->thread, NULL);
+        renderer->running = 0;
+    }
+
+    if (renderer->bands) {
+        for (int i = 0; i < pool_threads(renderer->workers); i++) {
+            free(renderer->bands[i]);
+        }
+        free(renderer->bands);
+        renderer->bands = NULL;
+    }
+    free(renderer->upscale_map);
+    renderer->upscale_map = NULL;
+    free(renderer->layers);
+    renderer->layers = NULL;
+    renderer->layers_capacity = 0;
+    free(renderer->history_pixels);
+    renderer->history_pixels = NULL;
+    renderer->history_capacity = 0;
+    free(renderer->loop_pixels);
+    renderer->loop_pixels = NULL;
+    renderer->loop_capacity = 0;
+    free(renderer->loop_done);
+    renderer->loop_done = NULL;
+    generator_destroy(&renderer->generator);
+    if (renderer->workers) {
+        pool_destroy(renderer->workers);
+        renderer->workers = NULL;
+    }
+    if (renderer->ready_fd >= 0) {
+        close(renderer->ready_fd);
+        renderer->ready_fd = -1;
+    }
+    if (renderer->wake_fd >= 0) {
+        close(renderer->wake_fd);
+        renderer->wake_fd = -1;
+        pthread_mutex_destroy(&renderer->control_lock);
+    }
+}
+
+struct pool_buffer* renderer_take_frame(struct renderer* renderer) {
+    return atomic_exchange(&renderer->ready, NULL);
+}
+
+struct buffer_pool* renderer_set_buffers(struct renderer* renderer, struct buffer_pool* buffers) {
+    struct buffer_pool* unused = atomic_exchange(&renderer->next_buffers, buffers);
+
+    // A render thread waiting for a buffer of the old size has to notice.
+    // Waking a pool it has just left is harmless.
+    signal_wake(renderer);
+    buffer_pool_wake(atomic_load(&renderer->buffers));
+    return unused;
+}
+
+void renderer_set_controls(struct renderer* renderer, const struct render_controls* controls) {
+    pthread_mutex_lock(&renderer->control_lock);
+    renderer->pending_controls = *controls;
+    renderer->controls_changed = 1;
+    pthread_mutex_unlock(&renderer->control_lock);
+
+    signal_wake(renderer);
+}
+
+struct buffer_pool* renderer_take_retired(struct renderer* renderer) {
+    return atomic_exchange(&renderer->retired, NULL);
+}
@@ -0,0 +1,214 @@
+#ifndef RENDERER_H_
+#define RENDERER_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "buffer_pool.h"
+#include "generator.h"
+#include "noise.h"
+
+/*
+** Background noise renderer for noysway
+**
+** A render thread draws a new slice into a free pool buffer every interval,
+** splitting the rows over a work-stealing pool. Frames are generated in
+** short steps, between which the render thread drops any frame a resize
+** or newer controls have made useless. A finished frame is
+** published by swapping it into ready, which replaces (and frees) any frame
+** the Wayland thread has not taken yet, then ready_fd is signalled. The
+** Wayland thread only ever takes the newest frame and never waits on
+** rendering.
+**
+** On resize the Wayland thread hands over a new pool. The render thread
+** drops the frame it is working on, switches to the new pool and pushes
+** the old one onto the retired list, where the Wayland thread picks it up
+** for destruction.
+**
+** Every frame is timed. Over budget the render resolution drops, with
+** headroom it climbs back to full size. Reduced frames fill the top left
+** of the buffer and are either scaled up by the compositor through a
+** viewport or, with upscale set, stretched over the buffer here.
+**
+** While the slice is held (speed 0) its octaves are kept as float layers.
+** Controls that only change the octave weights, persistence and amplitude,
+** then recombine the layers instead of evaluating the noise again.
+**
+** A copy of the last exact frame is kept with the grid it was sampled on.
+** A pan moves it by whole pixels and only the edges that came into view
+** are generated. A zoom first publishes it resampled onto the new grid,
+** then generates the exact frame, which new controls may abandon.
+**
+** With loop_frames set the depth wraps after that many slices and every
+** slice is sampled from 4D noise on a circle through z and w, so the last
+** one leads back into the first. Finished slices of the loop are kept and
+** replayed until the controls change.
+*/
+
+// Pixel noise state
+struct noise_state {
+    enum noise_engine engine;
+    int octaves;
+    double per;
+    double bfreq;
+    double bamp;
+};
+
+// Everything that can change while rendering
+struct render_controls {
+    struct noise_state noise;
+    // Depth added with every slice, 0 holds the current slice
+    double speed;
+    // Noise coordinates of the top left window pixel, and noise units per
+    // window pixel
+    double offset_x;
+    double offset_y;
+    double zoom;
+};
+
+struct render_options {
+    // Workers, <= 0 uses every core
+    int threads;
+    // Time between slices
+    int interval_ms;
+    // Frame time the resolution is scaled to hold, <= 0 keeps full size
+    int budget_ms;
+    // Stretch reduced frames to the buffer size on the CPU
+    int upscale;
+    // Slices of a seamless loop, <= 0 animates through 3D noise for ever
+    int loop_frames;
+    // Noise context of every frame, NULL samples noyc_default_context. Has
+    // to outlive the renderer.
+    const struct noyc_context* context;
+};
+
+struct pool;
+
+// What the cached octave layers were generated for
+struct layer_cache {
+    int valid;
+    struct buffer_pool* pool;
+    int width;
+    int height;
+    enum noise_engine engine;
+    int octaves;
+    double bfreq;
+    double depth;
+    double ow;
+    double offset_x;
+    double offset_y;
+    double zoom;
+};
+
+// Grid and parameters of the last exact frame
+struct frame_history {
+    int valid;
+    struct buffer_pool* pool;
+    int width;
+    int height;
+    double ox;
+    double oy;
+    double dx;
+    double dy;
+    double zoom;
+    double depth;
+    double ow;
+    struct noise_state noise;
+};
+
+// Controls the loop slices were rendered for, and the grid they share
+struct loop_cache {
+    int valid;
+    struct buffer_pool* pool;
+    int width;
+    int height;
+    double ox;
+    double oy;
+    double dx;
+    double dy;
+    double offset_x;
+    double offset_y;
+    double zoom;
+    struct noise_state noise;
+};
+
+struct renderer {
+    // Pool the render thread draws into, only the render thread switches it
+    _Atomic(struct buffer_pool*) buffers;
+    // Pool handed over by a resize, not picked up yet
+    _Atomic(struct buffer_pool*) next_buffers;
+    // Pools the render thread is done with, linked through next_retired
+    _Atomic(struct buffer_pool*) retired;
+
+    struct pool* workers;
+    struct generator generator;
+    const struct noyc_context* context;
+    // Band of rows per worker, band_width samples wide
+    double** bands;
+    int band_width;
+    int* upscale_map;
+
+    // Octave layers of the held slice
+    float* layers;
+    size_t layers_capacity;
+    struct layer_cache cached;
+
+    // Last exact frame, width x height pixels without padding
+    uint32_t* history_pixels;
+    size_t history_capacity;
+    struct frame_history history;
+
+    // Loop slices, loop_frames of width x height pixels, and which of them
+    // are done
+    int loop_frames;
+    uint32_t* loop_pixels;
+    size_t loop_capacity;
+    unsigned char* loop_done;
+    struct loop_cache loop;
+
+    // Controls of the render thread, and the ones set since the last frame
+    struct render_controls controls;
+    pthread_mutex_t control_lock;
+    struct render_controls pending_controls;
+    // Also read without the lock to abandon frames the controls outdated
+    atomic_int controls_changed;
+
+    double depth;
+    int interval_ms;
+    int budget_ms;
+    int upscale;
+    // Render resolution relative to the buffer size
+    double scale;
+
+    pthread_t thread;
+    int running;
+    atomic_int stop;
+    // Newest finished frame, NULL when there is none
+    _Atomic(struct pool_buffer*) ready;
+    // eventfd signalled whenever a frame is published
+    int ready_fd;
+    // eventfd that interrupts the render thread's sleep
+    int wake_fd;
+};
+
+// Returns -1 on failure
+int renderer_start(struct renderer* renderer, struct buffer_pool* buffers, const struct render_controls* controls,
+                   const struct render_options* options);
+void renderer_stop(struct renderer* renderer);
+
+// Newest finished frame, NULL when nothing new was published. The caller
+// owns the buffer until it is released. ready_fd is left to the caller's
+// event loop to drain.
+struct pool_buffer* renderer_take_frame(struct renderer* renderer);
+
+// Makes the render thread continue in buffers from its next frame on. The
+// frame in progress is abandoned. Returns a pool from an earlier call the
+// render thread never picked up, which the caller destroys.
+struct buffer_pool* renderer_set_buffers(struct renderer* renderer, struct buffer_pool* buffers);
+// Takes effect with the next frame, which is drawn right away
+void renderer_set_controls(struct renderer* renderer, const struct render_controls* controls);
+
+// Pools the render thread has left, linked through next_retired
+struct buffer_pool* renderer_take_retired(struct renderer* renderer);
+
+#endif // RENDERER_H_
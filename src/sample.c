@@ -0,0 +1,24 @@
+#include "sample.h"
+
+// Going through int32 keeps the wrap around of out of range values the same
+// for the scalar and the vectorized loop
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void samples_to_uint8(const double* values, uint8_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (uint8_t) (int32_t) ((values[i] * 0.5 + 0.5) * 255.0);
+    }
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void samples_to_uint16(const double* values, uint16_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (uint16_t) (int32_t) ((values[i] * 0.5 + 0.5) * 65535.0);
+    }
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void samples_to_float(const double* values, float* out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = (float) values[i];
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef SAMPLE_H_
+#define SAMPLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** Conversion of noise values into image samples
+**
+** Noise in [-1, 1] maps onto the full range of the integer formats, values
+** outside of it wrap around the same way the original 8 bit output always
+** did. Floats keep the noise value itself. Every conversion is cloned per
+** ISA so it runs at the same vector width as the grid kernels.
+*/
+
+void samples_to_uint8(const double* values, uint8_t* out, size_t n);
+void samples_to_uint16(const double* values, uint16_t* out, size_t n);
+void samples_to_float(const double* values, float* out, size_t n);
+
+#endif // SAMPLE_H_
@@ -0,0 +1,712 @@
+#include "simplex.h"
+
+#include <math.h>
+
+// Skew of a cube onto simplices and back
+#define F3 (1.0 / 3.0)
+#define G3 (1.0 / 6.0)
+#define F2 0.36602540378443864676 // (sqrt(3) - 1) / 2
+#define G2 0.21132486540518711775 // (3 - sqrt(3)) / 6
+#define F4 0.30901699437494742410 // (sqrt(5) - 1) / 4
+#define G4 0.13819660112501051518 // (5 - sqrt(5)) / 20
+
+// The improved Perlin gradient set, edge midpoints of a cube. h == 12 ||
+// h == 14 is spelled (h & 13) == 12 to keep the loops free of branches.
+static inline double simplex_grad(int hash, double x, double y, double z) {
+    int h = hash & 15;
+    double u = h<8 ? x : y;
+    double v = h<4 ? y : (h&13) == 12 ? x : z;
+    return ((h&1) == 0 ? u : -u) + ((h&2) == 0 ? v : -v);
+}
+
+// Falloff of one corner, zero beyond its radius. Evaluated either way so
+// the comparison only selects between two values. Every dimension uses a
+// squared radius of 0.5, a corner then fades out before the simplices it
+// belongs to end, with any larger one the noise steps at their borders.
+static inline double simplex_corner(double r, int hash, double x, double y, double z) {
+    double t = r - x*x - y*y - z*z;
+    double t2 = t * t;
+    double n = t2 * t2 * simplex_grad(hash, x, y, z);
+    return t < 0.0 ? 0.0 : n;
+}
+
+// Kept free of branches the compiler cannot turn into selects, and inlined
+// into every ISA clone, so the batched loops vectorize and still match the
+// scalar results
+__attribute__((always_inline))
+static inline double simplex3(const uint8_t* p, double x, double y, double z) {
+    double s = (x + y + z) * F3;
+    double fi = floor(x + s);
+    double fj = floor(y + s);
+    double fk = floor(z + s);
+    double t = (fi + fj + fk) * G3;
+
+    double x0 = x - (fi - t);
+    double y0 = y - (fj - t);
+    double z0 = z - (fk - t);
+
+    // The order of the offsets picks one of the six simplices of the cube
+    int a = x0 >= y0;
+    int b = y0 >= z0;
+    int c = x0 >= z0;
+    int i1 = a & (b | c);
+    int j1 = (!a) & b;
+    int k1 = (!b) & ((!a) | (!c));
+    int i2 = a | (b & c);
+    int j2 = (!a) | b;
+    int k2 = (!b) | ((!a) & (!c));
+
+    double x1 = x0 - i1 + G3;
+    double y1 = y0 - j1 + G3;
+    double z1 = z0 - k1 + G3;
+    double x2 = x0 - i2 + 2.0 * G3;
+    double y2 = y0 - j2 + 2.0 * G3;
+    double z2 = z0 - k2 + 2.0 * G3;
+    double x3 = x0 - 1.0 + 3.0 * G3;
+    double y3 = y0 - 1.0 + 3.0 * G3;
+    double z3 = z0 - 1.0 + 3.0 * G3;
+
+    int I = (int) fi & 255;
+    int J = (int) fj & 255;
+    int K = (int) fk & 255;
+
+    double n = simplex_corner(0.5, noyc_perm(p, I    + noyc_perm(p, J    + noyc_perm(p, K))), x0, y0, z0)
+             + simplex_corner(0.5, noyc_perm(p, I+i1 + noyc_perm(p, J+j1 + noyc_perm(p, K+k1))), x1, y1, z1)
+             + simplex_corner(0.5, noyc_perm(p, I+i2 + noyc_perm(p, J+j2 + noyc_perm(p, K+k2))), x2, y2, z2)
+             + simplex_corner(0.5, noyc_perm(p, I+1  + noyc_perm(p, J+1  + noyc_perm(p, K+1))), x3, y3, z3);
+    return 76.0 * n;
+}
+
+__attribute__((always_inline))
+static inline double simplex2(const uint8_t* p, double x, double y) {
+    double s = (x + y) * F2;
+    double fi = floor(x + s);
+    double fj = floor(y + s);
+    double t = (fi + fj) * G2;
+
+    double x0 = x - (fi - t);
+    double y0 = y - (fj - t);
+
+    // Lower or upper triangle of the square
+    int i1 = x0 > y0;
+    int j1 = !i1;
+
+    double x1 = x0 - i1 + G2;
+    double y1 = y0 - j1 + G2;
+    double x2 = x0 - 1.0 + 2.0 * G2;
+    double y2 = y0 - 1.0 + 2.0 * G2;
+
+    int I = (int) fi & 255;
+    int J = (int) fj & 255;
+
+    double n = simplex_corner(0.5, noyc_perm(p, I    + noyc_perm(p, J)), x0, y0, 0.0)
+             + simplex_corner(0.5, noyc_perm(p, I+i1 + noyc_perm(p, J+j1)), x1, y1, 0.0)
+             + simplex_corner(0.5, noyc_perm(p, I+1  + noyc_perm(p, J+1)), x2, y2, 0.0);
+    return 70.0 * n;
+}
+
+// 4D gradients, the 32 points with one zero and three unit components
+static inline double simplex_grad4(int hash, double x, double y, double z, double w) {
+    int h = hash & 31;
+    double a = h<24 ? x : y;
+    double b = h<16 ? y : z;
+    double c = h<8 ? z : w;
+    return ((h&1) == 0 ? a : -a) + ((h&2) == 0 ? b : -b) + ((h&4) == 0 ? c : -c);
+}
+
+static inline double simplex_corner4(int hash, double x, double y, double z, double w) {
+    double t = 0.5 - x*x - y*y - z*z - w*w;
+    double t2 = t * t;
+    double n = t2 * t2 * simplex_grad4(hash, x, y, z, w);
+    return t < 0.0 ? 0.0 : n;
+}
+
+__attribute__((always_inline))
+static inline double simplex4(const uint8_t* p, double x, double y, double z, double w) {
+    double s = (x + y + z + w) * F4;
+    double fi = floor(x + s);
+    double fj = floor(y + s);
+    double fk = floor(z + s);
+    double fl = floor(w + s);
+    double t = (fi + fj + fk + fl) * G4;
+
+    double x0 = x - (fi - t);
+    double y0 = y - (fj - t);
+    double z0 = z - (fk - t);
+    double w0 = w - (fl - t);
+
+    // Ranking the offsets picks one of the 24 simplices of the hypercube,
+    // the largest offset steps first
+    int rx = (x0 > y0) + (x0 > z0) + (x0 > w0);
+    int ry = (y0 >= x0) + (y0 > z0) + (y0 > w0);
+    int rz = (z0 >= x0) + (z0 >= y0) + (z0 > w0);
+    int rw = (w0 >= x0) + (w0 >= y0) + (w0 >= z0);
+
+    int i1 = rx >= 3, j1 = ry >= 3, k1 = rz >= 3, l1 = rw >= 3;
+    int i2 = rx >= 2, j2 = ry >= 2, k2 = rz >= 2, l2 = rw >= 2;
+    int i3 = rx >= 1, j3 = ry >= 1, k3 = rz >= 1, l3 = rw >= 1;
+
+    double x1 = x0 - i1 + G4;
+    double y1 = y0 - j1 + G4;
+    double z1 = z0 - k1 + G4;
+    double w1 = w0 - l1 + G4;
+    double x2 = x0 - i2 + 2.0 * G4;
+    double y2 = y0 - j2 + 2.0 * G4;
+    double z2 = z0 - k2 + 2.0 * G4;
+    double w2 = w0 - l2 + 2.0 * G4;
+    double x3 = x0 - i3 + 3.0 * G4;
+    double y3 = y0 - j3 + 3.0 * G4;
+    double z3 = z0 - k3 + 3.0 * G4;
+    double w3 = w0 - l3 + 3.0 * G4;
+    double x4 = x0 - 1.0 + 4.0 * G4;
+    double y4 = y0 - 1.0 + 4.0 * G4;
+    double z4 = z0 - 1.0 + 4.0 * G4;
+    double w4 = w0 - 1.0 + 4.0 * G4;
+
+    int I = (int) fi & 255;
+    int J = (int) fj & 255;
+    int K = (int) fk & 255;
+    int L = (int) fl & 255;
+
+    double n = simplex_corner4(noyc_perm(p, I    + noyc_perm(p, J    + noyc_perm(p, K    + noyc_perm(p, L)))), x0, y0, z0, w0)
+             + simplex_corner4(noyc_perm(p, I+i1 + noyc_perm(p, J+j1 + noyc_perm(p, K+k1 + noyc_perm(p, L+l1)))), x1, y1, z1, w1)
+             + simplex_corner4(noyc_perm(p, I+i2 + noyc_perm(p, J+j2 + noyc_perm(p, K+k2 + noyc_perm(p, L+l2)))), x2, y2, z2, w2)
+             + simplex_corner4(noyc_perm(p, I+i3 + noyc_perm(p, J+j3 + noyc_perm(p, K+k3 + noyc_perm(p, L+l3)))), x3, y3, z3, w3)
+             + simplex_corner4(noyc_perm(p, I+1  + noyc_perm(p, J+1  + noyc_perm(p, K+1  + noyc_perm(p, L+1)))), x4, y4, z4, w4);
+    return 62.0 * n;
+}
+
+double simplex_at(double x, double y, double z) {
+    return simplex3(noyc_context_perm(&noyc_default_context, 0), x, y, z);
+}
+
+double simplex_ctx_at(const struct noyc_context* context, double x, double y, double z) {
+    return simplex3(noyc_context_perm(context, 0), x, y, z);
+}
+
+double octave_simplex_at(double x, double y, double z, int octaves, double persistence, double bfreq, double bamp) {
+    return octave_simplex_ctx_at(&noyc_default_context, x, y, z, octaves, persistence, bfreq, bamp);
+}
+
+double octave_simplex_ctx_at(const struct noyc_context* context, double x, double y, double z, int octaves,
+                             double persistence, double bfreq, double bamp) {
+    double total = 0.0;
+    double frequency = bfreq;
+    double amplitude = bamp;
+    double max_value = 0.0;
+
+    for (int i = 0; i < octaves; i++) {
+        total += simplex3(noyc_context_perm(context, i), x * frequency, y * frequency, z * frequency) * amplitude;
+        max_value += amplitude;
+
+        amplitude *= persistence;
+        frequency *= 2;
+    }
+
+    return total / max_value;
+}
+
+// Cloned per ISA so the loop gets vectorized at the widest available width
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void perm_at_n(const uint8_t* p, const double* x, const double* y, const double* z, double* restrict out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = simplex3(p, x[i], y[i], z[i]);
+    }
+}
+
+void simplex_at_n(const double* x, const double* y, const double* z, double* out, size_t n) {
+    perm_at_n(noyc_context_perm(&noyc_default_context, 0), x, y, z, out, n);
+}
+
+void simplex_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                      double* out, size_t n) {
+    perm_at_n(noyc_context_perm(context, 0), x, y, z, out, n);
+}
+
+// Points are processed in chunks so the scaled coordinates stay in cache
+#define OCTAVE_CHUNK 256
+
+void octave_simplex_at_n(const double* x, const double* y, const double* z, double* out, size_t n,
+                         int octaves, double persistence, double bfreq, double bamp) {
+    octave_simplex_ctx_at_n(&noyc_default_context, x, y, z, out, n, octaves, persistence, bfreq, bamp);
+}
+
+void octave_simplex_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                             double* out, size_t n, int octaves, double persistence, double bfreq, double bamp) {
+    double sx[OCTAVE_CHUNK];
+    double sy[OCTAVE_CHUNK];
+    double sz[OCTAVE_CHUNK];
+    double value[OCTAVE_CHUNK];
+    double total[OCTAVE_CHUNK];
+
+    for (size_t start = 0; start < n; start += OCTAVE_CHUNK) {
+        size_t count = n - start < OCTAVE_CHUNK ? n - start : OCTAVE_CHUNK;
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (size_t i = 0; i < count; i++) {
+            total[i] = 0.0;
+        }
+
+        for (int o = 0; o < octaves; o++) {
+            for (size_t i = 0; i < count; i++) {
+                sx[i] = x[start + i] * frequency;
+                sy[i] = y[start + i] * frequency;
+                sz[i] = z[start + i] * frequency;
+            }
+
+            perm_at_n(noyc_context_perm(context, o), sx, sy, sz, value, count);
+
+            for (size_t i = 0; i < count; i++) {
+                total[i] += value[i] * amplitude;
+            }
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            out[start + i] = total[i] / max_value;
+        }
+    }
+}
+
+// Simplices do not line up with rows, so grids are rows of batched samples
+// with the coordinates laid out per chunk. Adds columns first to
+// first + width - 1 of a grid row to total, the column numbers of the whole
+// row keep every caller on the same coordinates.
+static void grid_row_octave(const uint8_t* p, double ox, double dx, int first, double sy, double sz, int width,
+                            double frequency, double amplitude, double* total) {
+    double sx[OCTAVE_CHUNK];
+    double syv[OCTAVE_CHUNK];
+    double szv[OCTAVE_CHUNK];
+    double value[OCTAVE_CHUNK];
+
+    for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+        int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+        for (int i = 0; i < count; i++) {
+            sx[i] = (ox + (first + start + i) * dx) * frequency;
+            syv[i] = sy;
+            szv[i] = sz;
+        }
+
+        perm_at_n(p, sx, syv, szv, value, (size_t) count);
+
+        for (int i = 0; i < count; i++) {
+            total[start + i] += value[i] * amplitude;
+        }
+    }
+}
+
+void simplex_fill_grid(double ox, double oy, double oz, double dx, double dy, int width, int height,
+                       int octaves, double persistence, double bfreq, double bamp, double* out) {
+    simplex_ctx_fill_grid(&noyc_default_context, ox, oy, oz, dx, dy, width, height,
+                          octaves, persistence, bfreq, bamp, out);
+}
+
+void simplex_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                           int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                           double* out) {
+    for (int j = 0; j < height; j++) {
+        double* total = out + (size_t) j * width;
+        double y = oy + j * dy;
+
+        for (int i = 0; i < width; i++) {
+            total[i] = 0.0;
+        }
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (int o = 0; o < octaves; o++) {
+            grid_row_octave(noyc_context_perm(context, o), ox, dx, 0, y * frequency, oz * frequency, width,
+                            frequency, amplitude, total);
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (int i = 0; i < width; i++) {
+            total[i] /= max_value;
+        }
+    }
+}
+
+void simplex_fill_layers(double ox, double oy, double oz, double dx, double dy, int width, int height,
+                         int octaves, double bfreq, float* layers, size_t layer_stride) {
+    simplex_ctx_fill_layers(&noyc_default_context, ox, oy, oz, dx, dy, width, height,
+                            octaves, bfreq, layers, layer_stride);
+}
+
+void simplex_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                             int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride) {
+    double total[OCTAVE_CHUNK];
+
+    for (int j = 0; j < height; j++) {
+        double y = oy + j * dy;
+        double frequency = bfreq;
+
+        for (int o = 0; o < octaves; o++) {
+            float* layer = layers + o * layer_stride + (size_t) j * width;
+
+            for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+                int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+                for (int i = 0; i < count; i++) {
+                    total[i] = 0.0;
+                }
+
+                grid_row_octave(noyc_context_perm(context, o), ox, dx, start, y * frequency, oz * frequency,
+                                count, frequency, 1.0, total);
+
+                for (int i = 0; i < count; i++) {
+                    layer[start + i] = (float) total[i];
+                }
+            }
+
+            frequency *= 2;
+        }
+    }
+}
+
+/*
+** 2D noise
+*/
+
+double simplex2_at(double x, double y) {
+    return simplex2(noyc_context_perm(&noyc_default_context, 0), x, y);
+}
+
+double simplex2_ctx_at(const struct noyc_context* context, double x, double y) {
+    return simplex2(noyc_context_perm(context, 0), x, y);
+}
+
+double octave_simplex2_at(double x, double y, int octaves, double persistence, double bfreq, double bamp) {
+    return octave_simplex2_ctx_at(&noyc_default_context, x, y, octaves, persistence, bfreq, bamp);
+}
+
+double octave_simplex2_ctx_at(const struct noyc_context* context, double x, double y, int octaves,
+                              double persistence, double bfreq, double bamp) {
+    double total = 0.0;
+    double frequency = bfreq;
+    double amplitude = bamp;
+    double max_value = 0.0;
+
+    for (int i = 0; i < octaves; i++) {
+        total += simplex2(noyc_context_perm(context, i), x * frequency, y * frequency) * amplitude;
+        max_value += amplitude;
+
+        amplitude *= persistence;
+        frequency *= 2;
+    }
+
+    return total / max_value;
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void perm2_at_n(const uint8_t* p, const double* x, const double* y, double* restrict out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = simplex2(p, x[i], y[i]);
+    }
+}
+
+void simplex2_at_n(const double* x, const double* y, double* out, size_t n) {
+    perm2_at_n(noyc_context_perm(&noyc_default_context, 0), x, y, out, n);
+}
+
+void simplex2_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, double* out, size_t n) {
+    perm2_at_n(noyc_context_perm(context, 0), x, y, out, n);
+}
+
+void octave_simplex2_at_n(const double* x, const double* y, double* out, size_t n,
+                          int octaves, double persistence, double bfreq, double bamp) {
+    octave_simplex2_ctx_at_n(&noyc_default_context, x, y, out, n, octaves, persistence, bfreq, bamp);
+}
+
+void octave_simplex2_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, double* out,
+                              size_t n, int octaves, double persistence, double bfreq, double bamp) {
+    double sx[OCTAVE_CHUNK];
+    double sy[OCTAVE_CHUNK];
+    double value[OCTAVE_CHUNK];
+    double total[OCTAVE_CHUNK];
+
+    for (size_t start = 0; start < n; start += OCTAVE_CHUNK) {
+        size_t count = n - start < OCTAVE_CHUNK ? n - start : OCTAVE_CHUNK;
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (size_t i = 0; i < count; i++) {
+            total[i] = 0.0;
+        }
+
+        for (int o = 0; o < octaves; o++) {
+            for (size_t i = 0; i < count; i++) {
+                sx[i] = x[start + i] * frequency;
+                sy[i] = y[start + i] * frequency;
+            }
+
+            perm2_at_n(noyc_context_perm(context, o), sx, sy, value, count);
+
+            for (size_t i = 0; i < count; i++) {
+                total[i] += value[i] * amplitude;
+            }
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            out[start + i] = total[i] / max_value;
+        }
+    }
+}
+
+static void grid2_row_octave(const uint8_t* p, double ox, double dx, int first, double sy, int width,
+                             double frequency, double amplitude, double* total) {
+    double sx[OCTAVE_CHUNK];
+    double syv[OCTAVE_CHUNK];
+    double value[OCTAVE_CHUNK];
+
+    for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+        int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+        for (int i = 0; i < count; i++) {
+            sx[i] = (ox + (first + start + i) * dx) * frequency;
+            syv[i] = sy;
+        }
+
+        perm2_at_n(p, sx, syv, value, (size_t) count);
+
+        for (int i = 0; i < count; i++) {
+            total[start + i] += value[i] * amplitude;
+        }
+    }
+}
+
+void simplex2_fill_grid(double ox, double oy, double dx, double dy, int width, int height,
+                        int octaves, double persistence, double bfreq, double bamp, double* out) {
+    simplex2_ctx_fill_grid(&noyc_default_context, ox, oy, dx, dy, width, height,
+                           octaves, persistence, bfreq, bamp, out);
+}
+
+void simplex2_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                            int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                            double* out) {
+    for (int j = 0; j < height; j++) {
+        double* total = out + (size_t) j * width;
+        double y = oy + j * dy;
+
+        for (int i = 0; i < width; i++) {
+            total[i] = 0.0;
+        }
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (int o = 0; o < octaves; o++) {
+            grid2_row_octave(noyc_context_perm(context, o), ox, dx, 0, y * frequency, width,
+                             frequency, amplitude, total);
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (int i = 0; i < width; i++) {
+            total[i] /= max_value;
+        }
+    }
+}
+
+void simplex2_fill_layers(double ox, double oy, double dx, double dy, int width, int height,
+                          int octaves, double bfreq, float* layers, size_t layer_stride) {
+    simplex2_ctx_fill_layers(&noyc_default_context, ox, oy, dx, dy, width, height, octaves, bfreq, layers, layer_stride);
+}
+
+void simplex2_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                              int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride) {
+    double total[OCTAVE_CHUNK];
+
+    for (int j = 0; j < height; j++) {
+        double y = oy + j * dy;
+        double frequency = bfreq;
+
+        for (int o = 0; o < octaves; o++) {
+            float* layer = layers + o * layer_stride + (size_t) j * width;
+
+            for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+                int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+                for (int i = 0; i < count; i++) {
+                    total[i] = 0.0;
+                }
+
+                grid2_row_octave(noyc_context_perm(context, o), ox, dx, start, y * frequency, count,
+                                 frequency, 1.0, total);
+
+                for (int i = 0; i < count; i++) {
+                    layer[start + i] = (float) total[i];
+                }
+            }
+
+            frequency *= 2;
+        }
+    }
+}
+
+/*
+** 4D noise
+*/
+
+double simplex4_at(double x, double y, double z, double w) {
+    return simplex4(noyc_context_perm(&noyc_default_context, 0), x, y, z, w);
+}
+
+double simplex4_ctx_at(const struct noyc_context* context, double x, double y, double z, double w) {
+    return simplex4(noyc_context_perm(context, 0), x, y, z, w);
+}
+
+double octave_simplex4_at(double x, double y, double z, double w, int octaves, double persistence,
+                          double bfreq, double bamp) {
+    return octave_simplex4_ctx_at(&noyc_default_context, x, y, z, w, octaves, persistence, bfreq, bamp);
+}
+
+double octave_simplex4_ctx_at(const struct noyc_context* context, double x, double y, double z, double w,
+                              int octaves, double persistence, double bfreq, double bamp) {
+    double total = 0.0;
+    double frequency = bfreq;
+    double amplitude = bamp;
+    double max_value = 0.0;
+
+    for (int i = 0; i < octaves; i++) {
+        total += simplex4(noyc_context_perm(context, i), x * frequency, y * frequency, z * frequency, w * frequency)
+            * amplitude;
+        max_value += amplitude;
+
+        amplitude *= persistence;
+        frequency *= 2;
+    }
+
+    return total / max_value;
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+static void perm4_at_n(const uint8_t* p, const double* x, const double* y, const double* z, const double* w,
+                       double* restrict out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = simplex4(p, x[i], y[i], z[i], w[i]);
+    }
+}
+
+void simplex4_at_n(const double* x, const double* y, const double* z, const double* w, double* out, size_t n) {
+    perm4_at_n(noyc_context_perm(&noyc_default_context, 0), x, y, z, w, out, n);
+}
+
+void simplex4_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                       const double* w, double* out, size_t n) {
+    perm4_at_n(noyc_context_perm(context, 0), x, y, z, w, out, n);
+}
+
+static void grid4_row_octave(const uint8_t* p, double ox, double dx, int first, double sy, double sz, double sw,
+                             int width, double frequency, double amplitude, double* total) {
+    double sx[OCTAVE_CHUNK];
+    double syv[OCTAVE_CHUNK];
+    double szv[OCTAVE_CHUNK];
+    double swv[OCTAVE_CHUNK];
+    double value[OCTAVE_CHUNK];
+
+    for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+        int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+        for (int i = 0; i < count; i++) {
+            sx[i] = (ox + (first + start + i) * dx) * frequency;
+            syv[i] = sy;
+            szv[i] = sz;
+            swv[i] = sw;
+        }
+
+        perm4_at_n(p, sx, syv, szv, swv, value, (size_t) count);
+
+        for (int i = 0; i < count; i++) {
+            total[start + i] += value[i] * amplitude;
+        }
+    }
+}
+
+void simplex4_fill_grid(double ox, double oy, double oz, double ow, double dx, double dy, int width, int height,
+                        int octaves, double persistence, double bfreq, double bamp, double* out) {
+    simplex4_ctx_fill_grid(&noyc_default_context, ox, oy, oz, ow, dx, dy, width, height,
+                           octaves, persistence, bfreq, bamp, out);
+}
+
+void simplex4_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                            double dx, double dy, int width, int height, int octaves, double persistence,
+                            double bfreq, double bamp, double* out) {
+    for (int j = 0; j < height; j++) {
+        double* total = out + (size_t) j * width;
+        double y = oy + j * dy;
+
+        for (int i = 0; i < width; i++) {
+            total[i] = 0.0;
+        }
+
+        double frequency = bfreq;
+        double amplitude = bamp;
+        double max_value = 0.0;
+
+        for (int o = 0; o < octaves; o++) {
+            grid4_row_octave(noyc_context_perm(context, o), ox, dx, 0, y * frequency, oz * frequency, ow * frequency,
+                             width, frequency, amplitude, total);
+            max_value += amplitude;
+
+            amplitude *= persistence;
+            frequency *= 2;
+        }
+
+        for (int i = 0; i < width; i++) {
+            total[i] /= max_value;
+        }
+    }
+}
+
+void simplex4_fill_layers(double ox, double oy, double oz, double ow, double dx, double dy, int width, int height,
+                          int octaves, double bfreq, float* layers, size_t layer_stride) {
+    simplex4_ctx_fill_layers(&noyc_default_context, ox, oy, oz, ow, dx, dy, width, height,
+                             octaves, bfreq, layers, layer_stride);
+}
+
+void simplex4_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                              double dx, double dy, int width, int height, int octaves, double bfreq,
+                              float* layers, size_t layer_stride) {
+    double total[OCTAVE_CHUNK];
+
+    for (int j = 0; j < height; j++) {
+        double y = oy + j * dy;
+        double frequency = bfreq;
+
+        for (int o = 0; o < octaves; o++) {
+            float* layer = layers + o * layer_stride + (size_t) j * width;
+
+            for (int start = 0; start < width; start += OCTAVE_CHUNK) {
+                int count = width - start < OCTAVE_CHUNK ? width - start : OCTAVE_CHUNK;
+                for (int i = 0; i < count; i++) {
+                    total[i] = 0.0;
+                }
+
+                grid4_row_octave(noyc_context_perm(context, o), ox, dx, start, y * frequency, oz * frequency,
+                                 ow * frequency, count, frequency, 1.0, total);
+
+                for (int i = 0; i < count; i++) {
+                    layer[start + i] = (float) total[i];
+                }
+            }
+
+            frequency *= 2;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef SIMPLEX_H_
+#define SIMPLEX_H_
+
+/*
+** Simplex noise
+**
+** Ken Perlin's 2001 successor to his lattice noise, after Stefan Gustavson's
+** "Simplex noise demystified". Space is split into skewed simplices, so a
+** 3D sample sums 4 corners instead of 8 and a 2D one 3 instead of 4. The
+** corners are hashed through the permutation tables of a noise context
+** onto the same gradient set as iperlin_at. Values lie in about [-1, 1].
+**
+** The functions mirror the iperlin.h API, *_ctx_* variants included, and
+** batched ones return bit-for-bit the values of the scalar ones.
+*/
+
+#include <stddef.h>
+
+#include "context.h"
+
+double simplex_at(double x, double y, double z);
+double octave_simplex_at(double x, double y, double z, int octaves, double persistence, double bfreq, double bamp);
+
+void simplex_at_n(const double* x, const double* y, const double* z, double* out, size_t n);
+void octave_simplex_at_n(const double* x, const double* y, const double* z, double* out, size_t n,
+                         int octaves, double persistence, double bfreq, double bamp);
+
+// out[j*width + i] equals octave_simplex_at(ox + i*dx, oy + j*dy, oz, ...)
+void simplex_fill_grid(double ox, double oy, double oz, double dx, double dy, int width, int height,
+                       int octaves, double persistence, double bfreq, double bamp, double* out);
+// Unweighted octave layers in the layout of iperlin_fill_layers, to be
+// recombined with iperlin_combine_layers
+void simplex_fill_layers(double ox, double oy, double oz, double dx, double dy, int width, int height,
+                         int octaves, double bfreq, float* layers, size_t layer_stride);
+
+double simplex_ctx_at(const struct noyc_context* context, double x, double y, double z);
+double octave_simplex_ctx_at(const struct noyc_context* context, double x, double y, double z, int octaves,
+                             double persistence, double bfreq, double bamp);
+void simplex_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                      double* out, size_t n);
+void octave_simplex_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                             double* out, size_t n, int octaves, double persistence, double bfreq, double bamp);
+void simplex_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                           int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                           double* out);
+void simplex_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double dx, double dy,
+                             int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride);
+
+// 2D variants. Unlike iperlin2_at these are not a slice of the 3D noise.
+double simplex2_at(double x, double y);
+double octave_simplex2_at(double x, double y, int octaves, double persistence, double bfreq, double bamp);
+void simplex2_at_n(const double* x, const double* y, double* out, size_t n);
+void octave_simplex2_at_n(const double* x, const double* y, double* out, size_t n,
+                          int octaves, double persistence, double bfreq, double bamp);
+void simplex2_fill_grid(double ox, double oy, double dx, double dy, int width, int height,
+                        int octaves, double persistence, double bfreq, double bamp, double* out);
+void simplex2_fill_layers(double ox, double oy, double dx, double dy, int width, int height,
+                          int octaves, double bfreq, float* layers, size_t layer_stride);
+
+double simplex2_ctx_at(const struct noyc_context* context, double x, double y);
+double octave_simplex2_ctx_at(const struct noyc_context* context, double x, double y, int octaves,
+                              double persistence, double bfreq, double bamp);
+void simplex2_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, double* out, size_t n);
+void octave_simplex2_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, double* out,
+                              size_t n, int octaves, double persistence, double bfreq, double bamp);
+void simplex2_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                            int width, int height, int octaves, double persistence, double bfreq, double bamp,
+                            double* out);
+void simplex2_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double dx, double dy,
+                              int width, int height, int octaves, double bfreq, float* layers, size_t layer_stride);
+
+// 4D variants, 5 corners per sample where a hypercube has 16
+double simplex4_at(double x, double y, double z, double w);
+double octave_simplex4_at(double x, double y, double z, double w, int octaves, double persistence,
+                          double bfreq, double bamp);
+void simplex4_at_n(const double* x, const double* y, const double* z, const double* w, double* out, size_t n);
+void simplex4_fill_grid(double ox, double oy, double oz, double ow, double dx, double dy, int width, int height,
+                        int octaves, double persistence, double bfreq, double bamp, double* out);
+void simplex4_fill_layers(double ox, double oy, double oz, double ow, double dx, double dy, int width, int height,
+                          int octaves, double bfreq, float* layers, size_t layer_stride);
+
+double simplex4_ctx_at(const struct noyc_context* context, double x, double y, double z, double w);
+double octave_simplex4_ctx_at(const struct noyc_context* context, double x, double y, double z, double w,
+                              int octaves, double persistence, double bfreq, double bamp);
+void simplex4_ctx_at_n(const struct noyc_context* context, const double* x, const double* y, const double* z,
+                       const double* w, double* out, size_t n);
+void simplex4_ctx_fill_grid(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                            double dx, double dy, int width, int height, int octaves, double persistence,
+                            double bfreq, double bamp, double* out);
+void simplex4_ctx_fill_layers(const struct noyc_context* context, double ox, double oy, double oz, double ow,
+                              double dx, double dy, int width, int height, int octaves, double bfreq,
+                              float* layers, size_t layer_stride);
+
+#endif // SIMPLEX_H_
@@ -2,6 +2,8 @@
 #include "wayland.h"
 
 #include <assert.h>
+#include <linux/input-event-codes.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -11,6 +13,45 @@
 #include <xkbcommon/xkbcommon-names.h>
 #include <xkbcommon/xkbcommon.h>
 
+// Zoom factor per unit of scroll, a wheel notch is usually 15 units
+#define ZOOM_PER_SCROLL 0.01
+
+#define OCTAVES_MAX 16
+#define PERSISTENCE_STEP 0.05
+#define FREQUENCY_STEP 1.25
+#define SPEED_STEP 1.5
+
+static void wl_seat_capabilities(void *data, struct wl_seat *seat,
+                                 uint32_t capabilities) {
+  struct app_state *state = (struct app_state *)data;
+
+  int have_pointer = capabilities & WL_SEAT_CAPABILITY_POINTER;
+  if (have_pointer && !state->pointer) {
+    state->pointer = wl_seat_get_pointer(seat);
+    wl_pointer_add_listener(state->pointer, &wl_pointer_listener, state);
+  } else if (!have_pointer && state->pointer) {
+    wl_pointer_release(state->pointer);
+    state->pointer = NULL;
+    state->dragging = 0;
+  }
+
+  int have_keyboard = capabilities & WL_SEAT_CAPABILITY_KEYBOARD;
+  if (have_keyboard && !state->keyboard) {
+    state->keyboard = wl_seat_get_keyboard(seat);
+    wl_keyboard_add_listener(state->keyboard, &wl_keyboard_listener, state);
+  } else if (!have_keyboard && state->keyboard) {
+    wl_keyboard_release(state->keyboard);
+    state->keyboard = NULL;
+  }
+}
+
+static void wl_seat_name(void *data, struct wl_seat *seat, const char *name) {}
+
+const struct wl_seat_listener wl_seat_listener = {
+    .capabilities = wl_seat_capabilities,
+    .name = wl_seat_name,
+};
+
 static void wl_pointer_enter(void *data, struct wl_pointer *pointer,
                              uint32_t serial, struct wl_surface *surface,
                              wl_fixed_t surface_x, wl_fixed_t surface_y) {
@@ -82,77 +123,59 @@ static void wl_pointer_axis_discrete(void *data, struct wl_pointer *pointer,
   state->pointer_event.axes[axis].discrete = discrete;
 }
 
-static void wl_pointer_frame_debug(void *data, struct wl_pointer *pointer) {
+// Applies everything the compositor grouped into one pointer frame, so a
+// burst of motion turns into a single change of the controls
+static void wl_pointer_frame(void *data, struct wl_pointer *pointer) {
   struct app_state *state = (struct app_state *)data;
   struct pointer_event *event = &state->pointer_event;
-  fprintf(stderr, "pointer frame @ %d: ", event->time);
-
-  if (event->event_mask & POINTER_EVENT_ENTER) {
-    fprintf(stderr, "entered %f, %f ", wl_fixed_to_double(event->surface_x),
-            wl_fixed_to_double(event->surface_y));
-  }
+  struct render_controls *controls = &state->controls;
 
   if (event->event_mask & POINTER_EVENT_LEAVE) {
-    fprintf(stderr, "leave");
+    state->dragging = 0;
   }
 
-  if (event->event_mask & POINTER_EVENT_MOTION) {
-    fprintf(stderr, "motion %f, %f ", wl_fixed_to_double(event->surface_x),
-            wl_fixed_to_double(event->surface_y));
+  if (event->event_mask & (POINTER_EVENT_ENTER | POINTER_EVENT_MOTION)) {
+    double x = wl_fixed_to_double(event->surface_x);
+    double y = wl_fixed_to_double(event->surface_y);
+
+    // Dragging moves the noise with the pointer
+    if (state->dragging && (event->event_mask & POINTER_EVENT_MOTION)) {
+      controls->offset_x -= (x - state->pointer_x) * controls->zoom;
+      controls->offset_y -= (y - state->pointer_y) * controls->zoom;
+      state->controls_dirty = 1;
+    }
+
+    state->pointer_x = x;
+    state->pointer_y = y;
   }
 
-  if (event->event_mask & POINTER_EVENT_BUTTON) {
-    char *state = event->state == WL_POINTER_BUTTON_STATE_RELEASED ? "released"
-                                                                   : "pressed";
-    fprintf(stderr, "button %d %s ", event->button, state);
+  if ((event->event_mask & POINTER_EVENT_BUTTON) && event->button == BTN_LEFT) {
+    state->dragging = event->state == WL_POINTER_BUTTON_STATE_PRESSED;
   }
 
-  uint32_t axis_events = POINTER_EVENT_AXIS | POINTER_EVENT_AXIS_SOURCE |
-                         POINTER_EVENT_AXIS_STOP | POINTER_EVENT_AXIS_DISCRETE;
-  char *axis_name[2] = {
-      [WL_POINTER_AXIS_VERTICAL_SCROLL] = "vertical",
-      [WL_POINTER_AXIS_HORIZONTAL_SCROLL] = "horizontal",
-  };
-  char *axis_source[4] = {
-      [WL_POINTER_AXIS_SOURCE_WHEEL] = "wheel",
-      [WL_POINTER_AXIS_SOURCE_FINGER] = "finger",
-      [WL_POINTER_AXIS_SOURCE_CONTINUOUS] = "continuous",
-      [WL_POINTER_AXIS_SOURCE_WHEEL_TILT] = "wheel tilt",
-  };
-  if (event->event_mask & axis_events) {
-    for (size_t i = 0; i < 2; ++i) {
-      if (!event->axes[i].valid) {
-        continue;
-      }
-      fprintf(stderr, "%s axis ", axis_name[i]);
-      if (event->event_mask & POINTER_EVENT_AXIS) {
-        fprintf(stderr, "value %f ", wl_fixed_to_double(event->axes[i].value));
-      }
-      if (event->event_mask & POINTER_EVENT_AXIS_DISCRETE) {
-        fprintf(stderr, "discrete %d ", event->axes[i].discrete);
-      }
-      if (event->event_mask & POINTER_EVENT_AXIS_SOURCE) {
-        fprintf(stderr, "via %s ", axis_source[event->axis_source]);
-      }
-      if (event->event_mask & POINTER_EVENT_AXIS_STOP) {
-        fprintf(stderr, "(stopped) ");
-      }
-    }
+  // Scrolling zooms around the pointer, the noise under it stays put
+  if ((event->event_mask & POINTER_EVENT_AXIS) &&
+      event->axes[WL_POINTER_AXIS_VERTICAL_SCROLL].valid) {
+    double value =
+        wl_fixed_to_double(event->axes[WL_POINTER_AXIS_VERTICAL_SCROLL].value);
+    double zoom = controls->zoom * exp(value * ZOOM_PER_SCROLL);
+
+    controls->offset_x += state->pointer_x * (controls->zoom - zoom);
+    controls->offset_y += state->pointer_y * (controls->zoom - zoom);
+    controls->zoom = zoom;
+    state->controls_dirty = 1;
   }
 
-  fprintf(stderr, "\n");
   memset(event, 0, sizeof(*event));
 }
 
-static void wl_pointer_frame_void(void *data, struct wl_pointer *pointer) {}
-
 const struct wl_pointer_listener wl_pointer_listener = {
     .enter = wl_pointer_enter,
     .leave = wl_pointer_leave,
     .motion = wl_pointer_motion,
     .button = wl_pointer_button,
     .axis = wl_pointer_axis,
-    .frame = wl_pointer_frame_void,
+    .frame = wl_pointer_frame,
     .axis_source = wl_pointer_axis_source,
     .axis_stop = wl_pointer_axis_stop,
     .axis_discrete = wl_pointer_axis_discrete,
@@ -163,7 +186,7 @@ static void wl_keyboard_keymap(void *data, struct wl_keyboard *keyboard,
   struct app_state *state = (struct app_state *)data;
   assert(format == WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1);
 
-  char *map_shm = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  char *map_shm = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
   assert(map_shm != MAP_FAILED);
 
   struct xkb_keymap *xkb_keymap = xkb_keymap_new_from_string(
@@ -181,43 +204,91 @@ static void wl_keyboard_keymap(void *data, struct wl_keyboard *keyboard,
 
 static void wl_keyboard_enter(void *data, struct wl_keyboard *keyboard,
                               uint32_t serial, struct wl_surface *surface,
-                              struct wl_array *keys) {
-  struct app_state *state = (struct app_state *)data;
-  fprintf(stderr, "keyboard enter; keys pressed are:\n");
-  uint32_t *key;
-  wl_array_for_each(key, keys) {
-    char buf[128];
-    xkb_keysym_t sym = xkb_state_key_get_one_sym(state->xkb_state, *key + 8);
-    xkb_keysym_get_name(sym, buf, sizeof(buf));
-    fprintf(stderr, "sym: %-12s (%d), ", buf, sym);
-    xkb_state_key_get_utf8(state->xkb_state, *key + 8, buf, sizeof(buf));
-    fprintf(stderr, "utf8: '%s'\n", buf);
-  }
-}
+                              struct wl_array *keys) {}
 
+// Arrows change octaves and persistence, page up and down the base
+// frequency, space holds the slice, brackets change the depth speed and e
+// cycles through the noise engines
 static void wl_keyboard_key(void *data, struct wl_keyboard *keyboard,
                             uint32_t serial, uint32_t time, uint32_t key,
                             uint32_t state) {
   struct app_state *cstate = (struct app_state *)data;
-  char buf[128];
+  if (state != WL_KEYBOARD_KEY_STATE_PRESSED || !cstate->xkb_state) {
+    return;
+  }
+
   uint32_t keycode = key + 8;
   xkb_keysym_t sym = xkb_state_key_get_one_sym(cstate->xkb_state, keycode);
-  xkb_keysym_get_name(sym, buf, sizeof(buf));
-  const char *action =
-      state == WL_KEYBOARD_KEY_STATE_PRESSED ? "press" : "release";
-  fprintf(stderr, "key %s: sym: %-12s (%d), ", action, buf, sym);
-  xkb_state_key_get_utf8(cstate->xkb_state, keycode, buf, sizeof(buf));
-  fprintf(stderr, "utf8: '%s'\n", buf);
-
-  if (sym == 32 && state == WL_KEYBOARD_KEY_STATE_RELEASED) {
-      cstate->regenerate = 1;
+
+  struct render_controls *controls = &cstate->controls;
+  struct noise_state *noise = &controls->noise;
+
+  switch (sym) {
+  case XKB_KEY_Up:
+    if (noise->octaves < OCTAVES_MAX) {
+      noise->octaves++;
+    }
+    break;
+  case XKB_KEY_Down:
+    if (noise->octaves > 1) {
+      noise->octaves--;
+    }
+    break;
+  case XKB_KEY_Right:
+    noise->per = fmin(noise->per + PERSISTENCE_STEP, 1.0);
+    break;
+  case XKB_KEY_Left:
+    noise->per = fmax(noise->per - PERSISTENCE_STEP, PERSISTENCE_STEP);
+    break;
+  case XKB_KEY_Page_Up:
+    noise->bfreq *= FREQUENCY_STEP;
+    break;
+  case XKB_KEY_Page_Down:
+    noise->bfreq /= FREQUENCY_STEP;
+    break;
+  case XKB_KEY_space:
+    if (controls->speed != 0.0) {
+      cstate->resume_speed = controls->speed;
+      controls->speed = 0.0;
+    } else {
+      controls->speed = cstate->resume_speed;
+    }
+    break;
+  case XKB_KEY_bracketright:
+    if (controls->speed != 0.0) {
+      controls->speed *= SPEED_STEP;
+    } else {
+      cstate->resume_speed *= SPEED_STEP;
+    }
+    break;
+  case XKB_KEY_bracketleft:
+    if (controls->speed != 0.0) {
+      controls->speed /= SPEED_STEP;
+    } else {
+      cstate->resume_speed /= SPEED_STEP;
+    }
+    break;
+  case XKB_KEY_e:
+    noise->engine = noise_engine_next(noise->engine);
+    break;
+  case XKB_KEY_Home:
+    controls->offset_x = 0.0;
+    controls->offset_y = 0.0;
+    controls->zoom = 1.0;
+    break;
+  case XKB_KEY_Escape:
+  case XKB_KEY_q:
+    cstate->closed = 1;
+    return;
+  default:
+    return;
   }
+
+  cstate->controls_dirty = 1;
 }
 
 static void wl_keyboard_leave(void *data, struct wl_keyboard *keyboard,
-                              uint32_t serial, struct wl_surface *surface) {
-  fprintf(stderr, "keyboard leave\n");
-}
+                              uint32_t serial, struct wl_surface *surface) {}
 
 static void wl_keyboard_modifiers(void *data, struct wl_keyboard *keyboard,
                                   uint32_t serial, uint32_t mods_depressed,
@@ -34,6 +34,9 @@ struct pointer_event {
     uint32_t axis_source;
 };
 
+// Listeners take the app_state as data. The seat listener creates the
+// pointer and keyboard and attaches the other two.
+extern const struct wl_seat_listener wl_seat_listener;
 extern const struct wl_pointer_listener wl_pointer_listener;
 extern const struct wl_keyboard_listener wl_keyboard_listener;
 
@@ -0,0 +1,80 @@
+#ifndef WAYLAND_H_
+#define WAYLAND_H_
+
+#include <wayland-client.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "input.h"
+#include "viewporter-protocol.h"
+#include "xdg-shell-protocol.h"
+
+#include "../buffer_pool.h"
+#include "../renderer.h"
+
+/*
+** noysway application state, shared by the window code and the input
+** listeners
+**
+** Input only edits controls and marks them dirty. The event loop hands
+** them to the renderer at most once per shown frame, so a burst of
+** pointer motion costs one render.
+*/
+
+// Our applciation state
+struct app_state {
+    // Wayland
+    struct wl_display* display;
+    struct wl_registry* registry;
+    struct wl_compositor* compositor;
+    struct wl_surface* surface;
+
+    // Shared memory
+    struct wl_shm* shm;
+    struct buffer_pool* buffers;
+
+    // Optional, lets the compositor scale reduced frames up
+    struct wp_viewporter* viewporter;
+    struct wp_viewport* viewport;
+
+    //XDG structures
+    struct xdg_wm_base* xdg_wm_base;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *xdg_toplevel;
+
+    // Input
+    struct wl_seat* seat;
+    struct wl_pointer* pointer;
+    struct wl_keyboard* keyboard;
+    struct pointer_event pointer_event;
+    struct xkb_context* xkb_context;
+    struct xkb_keymap* xkb_keymap;
+    struct xkb_state* xkb_state;
+
+    // Pointer position as of the last pointer frame, in surface pixels
+    double pointer_x;
+    double pointer_y;
+    int dragging;
+
+    // runtime params
+    int closed;
+    int width;
+    int height;
+
+    // First configure was acked, buffers may be attached
+    int configured;
+    // Last commit has not been shown yet
+    int frame_pending;
+    // Buffer of the last commit, source of resize previews. It is pinned,
+    // so the render thread cannot draw into it while it is shown.
+    struct pool_buffer* shown;
+
+    // Controls as input left them, and whether the renderer has them yet
+    struct render_controls controls;
+    int controls_dirty;
+    // Speed a held slice resumes with
+    double resume_speed;
+
+    struct renderer renderer;
+};
+
+#endif // WAYLAND_H_